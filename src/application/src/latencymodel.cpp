@@ -0,0 +1,91 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QDebug>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <algorithm>
+#include <cmath>
+#include "abstractextension.h"
+#include "latencymodel.h"
+
+
+/** ***************************************************************************/
+void LatencyModel::load() {
+    // The newest first, the windows keep the most recent ones
+    QSqlQuery query;
+    if (!query.exec("SELECT extensionId, runtime FROM runtimes ORDER BY rowid DESC LIMIT 8192;")) {
+        qWarning() << "Unable to load the runtimes:" << query.lastError();
+        return;
+    }
+    while (query.next()) {
+        Window &window = windows_[query.value(0).toString()];
+        if (window.runtimes.size() < WINDOW)
+            window.runtimes.push_back(query.value(1).toLongLong());
+    }
+
+    // Oldest first, the ring buffer overwrites the first slot next
+    for (std::pair<const QString, Window> &entry : windows_)
+        std::reverse(entry.second.runtimes.begin(), entry.second.runtimes.end());
+}
+
+
+
+/** ***************************************************************************/
+void LatencyModel::record(const std::map<AbstractExtension*, long int> &runtimes) {
+    QSqlDatabase db = QSqlDatabase::database();
+    db.transaction();
+    QSqlQuery sqlQuery;
+    for (const std::pair<AbstractExtension* const, long int> &e : runtimes) {
+        add(e.first->id, e.second);
+        sqlQuery.prepare("INSERT INTO runtimes (extensionId, runtime) VALUES (:extensionId, :runtime);");
+        sqlQuery.bindValue(":extensionId", e.first->id);
+        sqlQuery.bindValue(":runtime", static_cast<qulonglong>(e.second));
+        if (!sqlQuery.exec())
+            qWarning() << sqlQuery.lastError();
+    }
+    db.commit();
+}
+
+
+
+/** ***************************************************************************/
+long int LatencyModel::quantile(const QString &extensionId, double p) const {
+    std::map<QString, Window>::const_iterator it = windows_.find(extensionId);
+    if (it == windows_.end() || it->second.runtimes.empty())
+        return -1;
+    // The nearest rank
+    std::vector<long int> runtimes = it->second.runtimes;
+    const size_t rank = static_cast<size_t>(std::ceil(p * runtimes.size()));
+    const size_t n = std::min(runtimes.size(), std::max<size_t>(rank, 1)) - 1;
+    std::nth_element(runtimes.begin(), runtimes.begin() + static_cast<std::ptrdiff_t>(n), runtimes.end());
+    return runtimes[n];
+}
+
+
+
+/** ***************************************************************************/
+void LatencyModel::add(const QString &extensionId, long int runtime) {
+    // A ring buffer, once it is full
+    Window &window = windows_[extensionId];
+    if (window.runtimes.size() < WINDOW) {
+        window.runtimes.push_back(runtime);
+    } else {
+        window.runtimes[window.next] = runtime;
+        window.next = (window.next + 1) % WINDOW;
+    }
+}
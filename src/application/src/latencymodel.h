@@ -0,0 +1,59 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QString>
+#include <map>
+#include <vector>
+class AbstractExtension;
+
+/**
+ * @brief The LatencyModel class
+ * The recent runtimes of the query handlers of the extensions. Keeps the last
+ * WINDOW runtimes per extension in memory to estimate their distribution and
+ * writes all of them to the database. Used by the GUI thread only.
+ */
+class LatencyModel final
+{
+public:
+
+    /** Loads the recent runtimes of the database */
+    void load();
+
+    /** Records the runtimes of a query, in µs per extension */
+    void record(const std::map<AbstractExtension*, long int> &runtimes);
+
+    /**
+     * Estimates a quantile of the runtime of an extension
+     * @param p The quantile, e.g. 0.5 for the median
+     * @return The runtime in µs, -1 if the extension has no recent runtimes
+     */
+    long int quantile(const QString &extensionId, double p) const;
+
+private:
+
+    struct Window {
+        std::vector<long int> runtimes;
+        size_t next = 0; // The slot to overwrite, once it is full
+    };
+
+    void add(const QString &extensionId, long int runtime);
+
+    static const size_t WINDOW = 64;
+
+    std::map<QString, Window> windows_;
+
+};
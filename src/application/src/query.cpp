@@ -14,147 +14,194 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <QSqlQuery>
-#include <QSqlRecord>
-#include <QSqlError>
 #include <QtConcurrent/QtConcurrent>
 #include <QVariant>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <iterator>
 #include <map>
 #include "abstractaction.h"
 #include "abstractextension.h"
 #include "abstractitem.h"
 #include "query.h"
+#include "queryscheduler.h"
+#include "usagemodel.h"
 using std::chrono::system_clock;
 using std::map;
 
+namespace {
+// The time the handlers have to answer a query
+const std::chrono::milliseconds QUERY_DEADLINE(1000);
+}
 
-/** ***************************************************************************/
-map<QString, double> MatchOrder::order;
 
-bool MatchOrder::operator()(const pair<SharedItem, short> &lhs, const pair<SharedItem, short> &rhs) {
+/** ***************************************************************************/
+shared_ptr<const MatchOrder::Ranking> MatchOrder::ranking_
+        = std::make_shared<const MatchOrder::Ranking>(MatchOrder::lexicographicRanking());
+
+uint64_t MatchOrder::sortKey(const AbstractItem &item, short relevance, const UsageModel &usages,
+                             const vector<pair<uint32_t, double>> &prefixCounts) {
+    shared_ptr<const Ranking> ranking = std::atomic_load(&ranking_);
+    Features features{item.urgency(), 0, 0, 0, relevance};
+    usages.lookup(item.id(), prefixCounts, features.usage, features.recency, features.prefixUsage);
+    return (*ranking)(features);
+}
 
-    // Return true if urgency is higher
-    if (lhs.first->urgency() > rhs.first->urgency())
-        return true;
 
-    // Find the ids in the usage scores
-    const auto &lit = order.find(lhs.first->id());
-    const auto &rit = order.find(rhs.first->id());
 
-    // If left side has no entry it cannot be higher continue with relevance
-    if (lit==order.cend())
-        goto relevance;
+/** ***************************************************************************/
+void MatchOrder::setRanking(const Ranking &ranking) {
+    std::atomic_store(&ranking_, std::make_shared<const Ranking>(ranking));
+}
 
-    // If left side has an entry bur right side not left side must be higher
-    // given the condition that all values in the usage rankings are >0
-    if (rit==order.cend())
-        return true;
 
-    // Both scores available, return true if lhs is higher
-    if (order[lhs.first->id()] > order[rhs.first->id()]) // usage count
-        return true;
 
-    // Return true if relevance is higher else false
-    relevance:
-    return lhs.second > rhs.second; // percentual match of the query against the item
+/** ***************************************************************************/
+MatchOrder::Ranking MatchOrder::lexicographicRanking() {
+    return [](const Features &features) -> uint64_t {
+        // Bits 63-56 urgency, 55-40 and 39-16 fixed point usage for the
+        // input and overall, 15-0 relevance
+        const double prefixUsage = std::min(features.prefixUsage * (1 << 8), static_cast<double>((1 << 16) - 1));
+        const double usage = std::min(features.usage * (1 << 12), static_cast<double>((1 << 24) - 1));
+        return static_cast<uint64_t>(features.urgency) << 56
+                | static_cast<uint64_t>(prefixUsage) << 40
+                | static_cast<uint64_t>(usage) << 16
+                | static_cast<uint64_t>(std::max<short>(features.relevance, 0));
+    };
 }
 
-void MatchOrder::update() {
-    order.clear();
-
-    // Update the results ranking
-    QSqlQuery query;
-    query.exec("SELECT t.itemId AS id, SUM(t.score) AS usageScore "
-               "FROM ( "
-               " SELECT itemId, 1/max(julianday('now')-julianday(timestamp),1) AS score from usages "
-               ") t "
-               "GROUP BY t.itemId");
-    while (query.next())
-        MatchOrder::order.emplace(query.value(0).toString(),
-                                  query.value(1).toDouble());
+
+
+/** ***************************************************************************/
+MatchOrder::Ranking MatchOrder::weightedRanking(double usageWeight, double recencyWeight,
+                                                double prefixUsageWeight, double relevanceWeight) {
+    return [=](const Features &features) -> uint64_t {
+        // Map the unbounded usages to 0..1, the others are bounded already
+        const double score = usageWeight * features.usage / (1 + features.usage)
+                + recencyWeight * features.recency
+                + prefixUsageWeight * features.prefixUsage / (1 + features.prefixUsage)
+                + relevanceWeight * std::max<short>(features.relevance, 0) / SHRT_MAX;
+        const double total = std::max(usageWeight + recencyWeight + prefixUsageWeight + relevanceWeight, 1e-9);
+        const double normalized = std::min(std::max(score / total, 0.0), 1.0);
+
+        // 2^56-1 is not a double, the product can round up to 2^56. Clamp it,
+        // the score must not spill into the urgency.
+        const uint64_t maxScore = (uint64_t(1) << 56) - 1;
+        const uint64_t scaled = std::min<uint64_t>(static_cast<uint64_t>(normalized * static_cast<double>(uint64_t(1) << 56)), maxScore);
+        return static_cast<uint64_t>(features.urgency) << 56 | scaled;
+    };
 }
 
 
+
 /** ***************************************************************************/
 /** ***************************************************************************/
 /** ***************************************************************************/
 /** ***************************************************************************/
-Query::Query(const QString &query, const set<AbstractExtension *> &extensions)
+thread_local Query *Query::producerQuery_ = nullptr;
+thread_local SpscQueue<Query::Match> *Query::producerQueue_ = nullptr;
+
+Query::Query(const QString &query, const set<AbstractExtension *> &extensions, UsageModel &usages,
+             QueryScheduler &scheduler, FallbackCache &fallbackCache, uint64_t session)
     : searchTerm_(query),
-      isValid_(true),
+      usages_(usages),
+      prefixCounts_(usages.prefixCounts(query)),
+      session_(session),
       isRunning_(true),
       showFallbacks_(false),
-      mutex_(QMutex::Recursive) {
+      scheduler_(scheduler),
+      mutex_(QMutex::Recursive),
+      fetching_(0),
+      hasMore_(true),
+      extensions_(extensions.begin(), extensions.end()),
+      fallbackCache_(fallbackCache),
+      fallbacksReady_(false) {
 
     Q_ASSERT(!extensions.empty());
 
     /* Start multithreaded and asynchronous computation of results */
 
     // Check if some queries want to be runned by trigger
-    vector<AbstractExtension*> queryHandlers;
     for ( AbstractExtension *ext : extensions)
         if ( ext->runExclusive() )
             for ( QString triggerPrefix : ext->triggers() )
                 if ( searchTerm_.startsWith(triggerPrefix) )
-                    queryHandlers.push_back(ext);
+                    handlers_.push_back(ext);
 
-    if (queryHandlers.empty())
+    if (handlers_.empty())
         for ( AbstractExtension *ext : extensions)
             if ( !ext->runExclusive() )
-                queryHandlers.push_back(ext);
+                handlers_.push_back(ext);
+
+    // Handlers stop at the deadline, the token is shared from here on
+    token_.setDeadline(CancellationToken::Clock::now() + QUERY_DEADLINE);
 
-    // Start handlers
-    for (AbstractExtension *queryHandler : queryHandlers) {
+    // Insert the matches in batches, once per frame
+    insertTimer_.setInterval(16);
+    connect(&insertTimer_, &QTimer::timeout, this, &Query::insertPending);
+    insertTimer_.start();
+
+    // Schedule the handlers, each one adds its matches to a queue of its own
+    for (AbstractExtension *queryHandler : handlers_) {
         QFutureWatcher<void>* fw = new QFutureWatcher<void>(this);
         system_clock::time_point start = system_clock::now();
         connect(fw, &QFutureWatcher<void>::finished, [queryHandler, start, this](){
             runtimes_.emplace(queryHandler, std::chrono::duration_cast<std::chrono::microseconds>(system_clock::now()-start).count());
+            awaited_.erase(queryHandler);
             onHandlerFinished();
         });
-        fw->setFuture(QtConcurrent::run(queryHandler, &AbstractExtension::handleQuery, this));
+        pending_.emplace_back(new SpscQueue<Match>);
+        SpscQueue<Match> *queue = pending_.back().get();
+        fw->setFuture(scheduler.schedule(queryHandler, token_, [this, queryHandler, queue](){
+            producerQuery_ = this;
+            producerQueue_ = queue;
+            queryHandler->handleQuery(this);
+            producerQuery_ = nullptr;
+            producerQueue_ = nullptr;
+        }));
         futureWatchers_.push_back(fw);
     }
 
     emit started();
 
-    UXTimeOut_.setInterval(100);
+    // Publish when the usually fast handlers are done, the slow ones append
+    UXTimeOut_.setInterval(scheduler.uxTimeout(handlers_, awaited_));
     UXTimeOut_.setSingleShot(true);
     connect(&UXTimeOut_, &QTimer::timeout, this, &Query::onUXTimeOut);
     UXTimeOut_.start();
 
-    /* Get fallbacks */
-
-    // Request the fallbacks multithreaded
-    QFutureSynchronizer<vector<SharedItem>> synchronizer;
-    for ( AbstractExtension *ext : extensions)
-        synchronizer.addFuture(QtConcurrent::run(ext, &AbstractExtension::fallbacks, searchTerm_));
-    synchronizer.waitForFinished();
-
-    // Get fallbacks
-    for (const QFuture<vector<SharedItem>> &future : synchronizer.futures())
-        for (SharedItem &item : future.result())
-            fallbacks_.push_back(item);
+    // The fallbacks are requested lazily, unless they are known already
+    FallbackCache::const_iterator it = fallbackCache_.find(searchTerm_);
+    if (it != fallbackCache_.end()) {
+        fallbacks_ = it->second;
+        fallbacksReady_ = true;
+    }
 }
 
 
 
 /** ***************************************************************************/
 void Query::invalidate() {
-    isValid_ = false;
+    // Handlers poll the token and stop their searches
+    token_.cancel();
+    moreToken_.cancel();
 }
 
 
 
 /** ***************************************************************************/
 void Query::addMatch(shared_ptr<AbstractItem> item, short score) {
-    if ( isValid_ ) {
-        mutex_.lock();
-        beginInsertRows(QModelIndex(), matches_.size(), matches_.size());
-        matches_.push_back({item, score});
-        endInsertRows();
-        mutex_.unlock();
+    if ( !token_.isCancelled() ) {
+        // Rank in the handler thread, the sort compares the keys only
+        Match match{item, score, MatchOrder::sortKey(*item, score, usages_, *prefixCounts_)};
+        if (producerQuery_ == this)
+            producerQueue_->push(std::move(match));
+        else {
+            QMutexLocker locker(&mutex_);
+            pendingOther_.push_back(std::move(match));
+        }
     }
 }
 
@@ -163,21 +210,42 @@ void Query::addMatch(shared_ptr<AbstractItem> item, short score) {
 /** ***************************************************************************/
 void Query::addMatches(vector<std::pair<SharedItem,short>>::iterator begin,
                               vector<std::pair<SharedItem,short>>::iterator end) {
-    if ( isValid_ ) {
-        mutex_.lock();
-        beginInsertRows(QModelIndex(), matches_.size(), matches_.size() + std::distance(begin, end));
-        matches_.insert(matches_.end(), begin, end);
-        endInsertRows();
-        mutex_.unlock();
+    for (auto it = begin; it != end; ++it)
+        addMatch(it->first, it->second);
+}
+
+
+
+/** ***************************************************************************/
+void Query::insertPending() {
+    // Collect the matches added since the last call
+    vector<Match> matches;
+    for (const std::unique_ptr<SpscQueue<Match>> &queue : pending_)
+        queue->drain(matches);
+    {
+        QMutexLocker locker(&mutex_);
+        std::move(pendingOther_.begin(), pendingOther_.end(), std::back_inserter(matches));
+        pendingOther_.clear();
     }
+    if (matches.empty())
+        return;
+
+    // Insert them at once, the view updates once
+    const int first = static_cast<int>(matches_.size());
+    beginInsertRows(QModelIndex(), first, first + static_cast<int>(matches.size()) - 1);
+    std::move(matches.begin(), matches.end(), std::back_inserter(matches_));
+    endInsertRows();
 }
 
 
 
 /** ***************************************************************************/
 void Query::onUXTimeOut() {
+    insertPending();
     mutex_.lock();
-    std::sort(matches_.begin(), matches_.end(), MatchOrder());
+    std::sort(matches_.begin(), matches_.end(), [](const Match &lhs, const Match &rhs){
+        return lhs.sortKey > rhs.sortKey;
+    });
     mutex_.unlock();
     emit resultsReady(this);
 }
@@ -190,7 +258,17 @@ void Query::onHandlerFinished(){
     bool fin = true;
     for (QFutureWatcher<void> const  * const futureWatcher : futureWatchers_)
         fin &= futureWatcher->isFinished();
+
+    // Publish early if the handlers worth waiting for are done
+    if ( !fin && awaited_.empty() && UXTimeOut_.isActive() ) {
+        UXTimeOut_.stop();
+        onUXTimeOut();
+    }
+
     if ( fin ) {
+        insertPending();
+        insertTimer_.stop();
+
         /*
          * If the query finished before the UX timeout timed out everything is
          * fine. If not (UXTimeOut timer still active) the results have already
@@ -202,25 +280,15 @@ void Query::onHandlerFinished(){
             onUXTimeOut();
         }
         if (matches_.size()==0) {
-            beginResetModel();
-            showFallbacks_ = true;
-            endResetModel();
+            if (fallbacksReady_)
+                showFallbacks();
+            else
+                requestFallbacks(); // Shown when they are ready
         }
 
-        // Save runtimes
-        if (isValid_){ // Dont count cancelled queries
-            QSqlDatabase db = QSqlDatabase::database();
-            db.transaction();
-            QSqlQuery sqlQuery;
-            for (auto &e : runtimes_) {
-                sqlQuery.prepare("INSERT INTO runtimes (extensionId, runtime) VALUES (:extensionId, :runtime);");
-                sqlQuery.bindValue(":extensionId", e.first->id);
-                sqlQuery.bindValue(":runtime", static_cast<qulonglong>(e.second));
-                if (!sqlQuery.exec())
-                    qWarning() << sqlQuery.lastError();
-            }
-            db.commit();
-        }
+        // Save runtimes, they drive the timeouts of the next queries
+        if (!token_.isCancelled()) // Dont count cancelled queries
+            scheduler_.recordRuntimes(runtimes_);
 
         isRunning_=false;
         emit finished();
@@ -237,12 +305,64 @@ int Query::rowCount(const QModelIndex &parent) const {
 
 
 
+/** ***************************************************************************/
+bool Query::canFetchMore(const QModelIndex &parent) const {
+    // The results of a running query are still coming in
+    return !parent.isValid() && !isRunning_ && !showFallbacks_ && hasMore_ && !handlers_.empty()
+            && !token_.isCancelled();
+}
+
+
+
+/** ***************************************************************************/
+void Query::fetchMore(const QModelIndex &parent) {
+    if (!canFetchMore(parent))
+        return;
+
+    // Ask the handlers for their next matches, appended when all are done.
+    // Running again, the query is not deleted meanwhile.
+    isRunning_ = true;
+    fetching_ = handlers_.size();
+    const size_t rows = matches_.size();
+    for (size_t i = 0; i < handlers_.size(); ++i) {
+        AbstractExtension *queryHandler = handlers_[i];
+        SpscQueue<Match> *queue = pending_[i].get();
+        QFutureWatcher<void>* fw = new QFutureWatcher<void>(this);
+        connect(fw, &QFutureWatcher<void>::finished, [this, fw, rows](){
+            fw->deleteLater();
+            if (--fetching_ == 0)
+                onMoreFinished(rows);
+        });
+        fw->setFuture(scheduler_.schedule(queryHandler, moreToken_, [this, queryHandler, queue](){
+            producerQuery_ = this;
+            producerQueue_ = queue;
+            queryHandler->handleQueryMore(this);
+            producerQuery_ = nullptr;
+            producerQueue_ = nullptr;
+        }));
+    }
+}
+
+
+
+/** ***************************************************************************/
+void Query::onMoreFinished(size_t rows) {
+    // Append the further matches, the ones on display stay where they are.
+    // No more to fetch if none of the handlers added any.
+    insertPending();
+    hasMore_ = matches_.size() > rows;
+    isRunning_ = false;
+    emit finished();
+}
+
+
+
 /** ***************************************************************************/
 QVariant Query::data(const QModelIndex &index, int role) const {
     if (index.isValid()) {
         SharedItem item = showFallbacks_
                 ? fallbacks_[static_cast<size_t>(index.row())]
-                : matches_[static_cast<size_t>(index.row())].first;
+                : matches_[static_cast<size_t>(index.row())].item;
 
         switch (role) {
         case Qt::DisplayRole:
@@ -284,7 +404,7 @@ bool Query::setData(const QModelIndex &index, const QVariant &value, int role) {
         mutex_.lock();
         SharedItem item = showFallbacks_
                 ? fallbacks_[static_cast<size_t>(index.row())]
-                : matches_[static_cast<size_t>(index.row())].first;
+                : matches_[static_cast<size_t>(index.row())].item;
         mutex_.unlock();
         switch (role) {
 
@@ -302,6 +422,13 @@ bool Query::setData(const QModelIndex &index, const QVariant &value, int role) {
                 item->actions()[0]->activate();
             break;
         case Qt::UserRole+101: // AltAction
+            // The user asked for them, wait if they are not there yet
+            if (!fallbacksReady_) {
+                requestFallbacks();
+                for (QFutureWatcher<vector<SharedItem>> *watcher : fallbackWatchers_)
+                    watcher->waitForFinished();
+                onFallbacksFinished();
+            }
             if (0U < fallbacks_.size() && 0U < item->actions().size()) {
                 item = fallbacks_[0];
                 item->actions()[0]->activate();
@@ -323,14 +450,55 @@ bool Query::setData(const QModelIndex &index, const QVariant &value, int role) {
         }
 
         // Save usage
-        if (isValid_){ // Dont count cancelled queries
-            QSqlQuery query;
-            query.prepare("INSERT INTO usages (input, itemId) VALUES (:input, :itemId);");
-            query.bindValue(":input", searchTerm_);
-            query.bindValue(":itemId", item->id());
-            if (!query.exec())
-                qWarning() << query.lastError();
-        }
+        if (!token_.isCancelled()) // Dont count cancelled queries
+            usages_.record(item->id(), searchTerm_);
     }
     return false;
 }
+
+
+
+/** ***************************************************************************/
+void Query::requestFallbacks() {
+    if (fallbacksReady_ || !fallbackWatchers_.empty())
+        return;
+
+    // Request the fallbacks multithreaded, they are collected when all are done
+    for (AbstractExtension *ext : extensions_) {
+        QFutureWatcher<vector<SharedItem>> *fw = new QFutureWatcher<vector<SharedItem>>(this);
+        connect(fw, &QFutureWatcher<vector<SharedItem>>::finished, this, &Query::onFallbacksFinished);
+        fw->setFuture(QtConcurrent::run(ext, &AbstractExtension::fallbacks, searchTerm_));
+        fallbackWatchers_.push_back(fw);
+    }
+}
+
+
+
+/** ***************************************************************************/
+void Query::onFallbacksFinished() {
+    if (fallbacksReady_)
+        return;
+    for (QFutureWatcher<vector<SharedItem>> const * const fw : fallbackWatchers_)
+        if (!fw->isFinished())
+            return;
+
+    // Get fallbacks, in the order of the extensions
+    for (QFutureWatcher<vector<SharedItem>> const * const fw : fallbackWatchers_)
+        for (const SharedItem &item : fw->result())
+            fallbacks_.push_back(item);
+    fallbacksReady_ = true;
+    fallbackCache_.emplace(searchTerm_, fallbacks_);
+
+    // Show them if the query ended up without matches
+    if (!isRunning_ && matches_.empty())
+        showFallbacks();
+}
+
+
+
+/** ***************************************************************************/
+void Query::showFallbacks() {
+    beginResetModel();
+    showFallbacks_ = true;
+    endResetModel();
+}
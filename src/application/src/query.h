@@ -20,12 +20,16 @@
 #include <QMutex>
 #include <QString>
 #include <QTimer>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <set>
 #include <vector>
 #include <utility>
 #include <memory>
+#include "abstractitem.h"
 #include "abstractquery.h"
+#include "spscqueue.h"
 using std::set;
 using std::map;
 using std::vector;
@@ -33,12 +37,54 @@ using std::pair;
 using std::shared_ptr;
 class AbstractExtension;
 class AbstractItem;
+class QueryScheduler;
+class UsageModel;
 typedef shared_ptr<AbstractItem> SharedItem;
 
-struct MatchOrder {
-    inline bool operator() (const pair<SharedItem, short>& lhs, const pair<SharedItem, short>& rhs);
-    static void update();
-    static map<QString, double> order;
+/** The fallbacks of the search terms of a session */
+typedef map<QString, vector<SharedItem>> FallbackCache;
+
+/**
+ * @brief The MatchOrder class
+ * Ranks the matches by a single integer sort key, computed once per match when
+ * it is added. The ranking function mapping the properties of a match to its
+ * key is pluggable.
+ */
+class MatchOrder final
+{
+public:
+
+    /** The properties of a match the ranking is based on */
+    struct Features {
+        AbstractItem::Urgency urgency;
+        double usage;    // Sum of the activations, each halved every 7 days (UsageModel::HALF_LIFE_DAYS)
+        double recency;  // 1/days since the last activation, 0 if never activated
+        double prefixUsage; // Like usage, counting the activations for the current input only
+        short relevance; // The match score of the extension, 0..SHRT_MAX
+    };
+
+    /** Maps the features of a match to its sort key, higher keys rank first */
+    typedef std::function<uint64_t(const Features &)> Ranking;
+
+    /** Returns the sort key of a match. Thread safe. */
+    static uint64_t sortKey(const AbstractItem &item, short relevance, const UsageModel &usages,
+                            const vector<pair<uint32_t, double>> &prefixCounts);
+
+    /** Sets the ranking function, used for the matches added afterwards */
+    static void setRanking(const Ranking &ranking);
+
+    /** Ranks by urgency, then usage for the input, usage, relevance. The default. */
+    static Ranking lexicographicRanking();
+
+    /** Ranks by urgency, then by the weighted sum of the normalized features */
+    static Ranking weightedRanking(double usageWeight, double recencyWeight,
+                                   double prefixUsageWeight, double relevanceWeight);
+
+private:
+
+    // Immutable, replaced as a whole. Read concurrently by the query threads.
+    static shared_ptr<const Ranking> ranking_;
+
 };
 
 class Query final : public QAbstractListModel, public AbstractQuery
@@ -47,7 +93,8 @@ class Query final : public QAbstractListModel, public AbstractQuery
 
 public:
 
-    Query(const QString &query, const set<AbstractExtension*> &queryHandlers);
+    Query(const QString &query, const set<AbstractExtension*> &queryHandlers, UsageModel &usages,
+          QueryScheduler &scheduler, FallbackCache &fallbackCache, uint64_t session);
 
     void addMatch(shared_ptr<AbstractItem> item, short score = 0) override;
     void addMatches(vector<std::pair<SharedItem,short>>::iterator begin,
@@ -55,29 +102,73 @@ public:
 
     const QString &searchTerm() const override { return searchTerm_; }
     bool isRunning() { return isRunning_; }
-    bool isValid() const override { return isValid_; }
+    bool isValid() const override { return !token_.isCancelled(); }
+    const CancellationToken &token() const override { return token_; }
+    uint64_t session() const override { return session_; }
     void invalidate();
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
     QVariant data(const QModelIndex &index, int role) const override;
     bool setData(const QModelIndex &index, const QVariant &value, int role) override;
 
 private:
 
+    struct Match {
+        SharedItem item;
+        short score;
+        uint64_t sortKey;
+    };
+
     void onUXTimeOut();
     void onHandlerFinished();
+    void onMoreFinished(size_t rows);
+    void insertPending();
+    void requestFallbacks();
+    void onFallbacksFinished();
+    void showFallbacks();
 
     const QString searchTerm_;
-    bool isValid_;
+    UsageModel &usages_;
+    const shared_ptr<const vector<pair<uint32_t, double>>> prefixCounts_;
+    CancellationToken token_;
+    const uint64_t session_;
     bool isRunning_;
     bool showFallbacks_;
 
+    QueryScheduler &scheduler_;
+    vector<AbstractExtension*> handlers_;
     vector<QFutureWatcher<void>*> futureWatchers_;
     map<AbstractExtension*, long int> runtimes_;
+    set<AbstractExtension*> awaited_; // The handlers to wait for before publishing
     mutable QMutex mutex_;
     QTimer UXTimeOut_;
 
-    vector<pair<SharedItem, short>> matches_;
+    // The matches not inserted yet. A queue per handler, a locked vector for
+    // matches added by other threads. Inserted in batches by insertTimer_.
+    vector<std::unique_ptr<SpscQueue<Match>>> pending_;
+    vector<Match> pendingOther_;
+    QTimer insertTimer_;
+
+    // The query and the queue of the handler running in this thread
+    static thread_local Query *producerQuery_;
+    static thread_local SpscQueue<Match> *producerQueue_;
+
+    vector<Match> matches_;
+
+    // Further matches are fetched on demand, while the handlers have more.
+    // The token has no deadline, the user scrolls when the query is done.
+    CancellationToken moreToken_;
+    size_t fetching_; // The handlers still fetching
+    bool hasMore_;
+
+    // Computed on demand only, i.e. if there are no matches or on activation
+    // by the alt modifier. Shared by the queries of a session.
+    const vector<AbstractExtension*> extensions_;
+    FallbackCache &fallbackCache_;
+    vector<QFutureWatcher<vector<SharedItem>>*> fallbackWatchers_;
+    bool fallbacksReady_;
     vector<SharedItem> fallbacks_;
 
 signals:
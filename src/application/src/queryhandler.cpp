@@ -20,6 +20,7 @@
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QtConcurrent/QtConcurrent>
+#include <algorithm>
 #include <chrono>
 #include "abstractextension.h"
 #include "extensionmanager.h"
@@ -30,13 +31,26 @@
 QueryHandler::QueryHandler(ExtensionManager* em, QObject *parent)
     : QObject(parent),
       extensionManager_(em),
-      currentQuery_(nullptr) {
-    // Initialize the order
-    MatchOrder::update();
+      currentQuery_(nullptr),
+      shownModel_(nullptr),
+      session_(1) {
+    // Load the usages in the background
+    usageModel_.load();
+
+    // The recent runtimes of the handlers, few and needed by the first query
+    scheduler_.loadRuntimes();
+
+    // Track the model on display, past queries are kept for it only
+    connect(this, &QueryHandler::resultsReady, [this](QAbstractItemModel *model){
+        shownModel_ = model;
+    });
 }
 
 /** ***************************************************************************/
 void QueryHandler::setupSession() {
+    // The queries of a session share the search caches of the handlers
+    ++session_;
+
     // Call all setup routines
     std::chrono::system_clock::time_point start, end;
     for (AbstractExtension *e : extensionManager_->extensions()){
@@ -69,8 +83,11 @@ void QueryHandler::teardownSession() {
             delete qp/*->deleteLater()*/;
     pastQueries_.clear();
 
-    // Compute new match rankings
-    MatchOrder::update();
+    // The fallbacks may depend on the session, e.g. the time
+    fallbackCache_.clear();
+
+    // Age the usages
+    usageModel_.decay();
 }
 
 /** ***************************************************************************/
@@ -84,6 +101,15 @@ void QueryHandler::startQuery(const QString &searchTerm) {
         pastQueries_.push_back(currentQuery_);
     }
 
+    // Delete the stale queries that are neither running nor on display
+    vector<Query*>::iterator end = std::remove_if(pastQueries_.begin(), pastQueries_.end(), [this](Query *qp){
+        if (qp->isRunning() || qp == shownModel_)
+            return false;
+        delete qp;
+        return true;
+    });
+    pastQueries_.erase(end, pastQueries_.end());
+
     // Do nothing if nothing is loaded
     if (extensionManager_->extensions().empty())
         return;
@@ -93,7 +119,7 @@ void QueryHandler::startQuery(const QString &searchTerm) {
         currentQuery_ = nullptr;
         emit resultsReady(nullptr);
     } else {
-        currentQuery_ = new Query(searchTerm, extensionManager_->extensions());
+        currentQuery_ = new Query(searchTerm, extensionManager_->extensions(), usageModel_, scheduler_, fallbackCache_, session_);
         connect(currentQuery_, &Query::resultsReady, this, &QueryHandler::resultsReady);
     }
 }
@@ -17,10 +17,12 @@
 #pragma once
 #include <QObject>
 #include <vector>
+#include "query.h"
+#include "queryscheduler.h"
+#include "usagemodel.h"
 using std::vector;
 class ExtensionManager;
 class QAbstractItemModel;
-class Query;
 
 class QueryHandler : public QObject
 {
@@ -39,6 +41,11 @@ private:
     ExtensionManager *extensionManager_;
     Query *currentQuery_;
     vector<Query*> pastQueries_;
+    QAbstractItemModel *shownModel_;
+    FallbackCache fallbackCache_;
+    uint64_t session_;
+    UsageModel usageModel_;
+    QueryScheduler scheduler_; // Destroyed first, the handlers use the usages
 
 signals:
 
@@ -0,0 +1,151 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QMutexLocker>
+#include <algorithm>
+#include <utility>
+#include "abstractextension.h"
+#include "cancellationtoken.h"
+#include "queryscheduler.h"
+
+const int QueryScheduler::MIN_UX_TIMEOUT;
+const int QueryScheduler::MAX_UX_TIMEOUT;
+
+/** ***************************************************************************/
+class QueryScheduler::Runner final : public QRunnable
+{
+public:
+
+    Runner(QueryScheduler *scheduler, Job &&job) : scheduler_(scheduler), job_(std::move(job)) {}
+
+    void run() override {
+        // Skip the work if the query got stale since the job was dispatched
+        if (!job_.token->stopRequested())
+            job_.work();
+        scheduler_->finish(job_.extension);
+        job_.future.reportFinished();
+    }
+
+private:
+
+    QueryScheduler *scheduler_;
+    Job job_;
+
+};
+
+
+
+/** ***************************************************************************/
+QueryScheduler::QueryScheduler() : running_(0), sequence_(0) {
+}
+
+
+
+/** ***************************************************************************/
+QueryScheduler::~QueryScheduler() {
+    // Drop the waiting jobs, wait for the running ones
+    {
+        QMutexLocker locker(&mutex_);
+        for (Job &job : queued_)
+            job.future.reportFinished();
+        queued_.clear();
+    }
+    pool_.waitForDone();
+}
+
+
+
+/** ***************************************************************************/
+QFuture<void> QueryScheduler::schedule(AbstractExtension *extension, const CancellationToken &token,
+                                       std::function<void()> work) {
+    QMutexLocker locker(&mutex_);
+    queued_.push_back(Job{sequence_++, extension, &token, std::move(work), QFutureInterface<void>()});
+    queued_.back().future.reportStarted();
+    QFuture<void> future = queued_.back().future.future();
+    dispatch();
+    return future;
+}
+
+
+
+/** ***************************************************************************/
+void QueryScheduler::dispatch() {
+    // Called locked. Newest first, such that the current query overtakes the
+    // stale ones. Jobs of an extension at its limit stay queued.
+    for (size_t i = queued_.size(); i-- > 0;) {
+        Job &job = queued_[i];
+        if (job.token->stopRequested()) {
+            job.future.reportFinished();
+            queued_.erase(queued_.begin() + static_cast<std::ptrdiff_t>(i));
+            continue;
+        }
+        if (running_ >= pool_.maxThreadCount())
+            continue;
+        int &inFlight = inFlight_[job.extension];
+        if (inFlight >= job.extension->maxConcurrentQueries())
+            continue;
+        ++inFlight;
+        ++running_;
+        pool_.start(new Runner(this, std::move(job)));
+        queued_.erase(queued_.begin() + static_cast<std::ptrdiff_t>(i));
+    }
+}
+
+
+
+/** ***************************************************************************/
+void QueryScheduler::finish(AbstractExtension *extension) {
+    // A slot is free, start the next waiting job
+    QMutexLocker locker(&mutex_);
+    --inFlight_[extension];
+    --running_;
+    dispatch();
+}
+
+
+
+/** ***************************************************************************/
+int QueryScheduler::uxTimeout(const std::vector<AbstractExtension*> &handlers,
+                              std::set<AbstractExtension*> &awaited) const {
+    // Wait for the handlers that are usually fast, at most as long as they
+    // usually take. Handlers without runtimes yet get the maximal timeout.
+    long int timeout = 0;
+    for (AbstractExtension *handler : handlers) {
+        const long int median = latencies_.quantile(handler->id, 0.5);
+        if (median > MAX_UX_TIMEOUT * 1000L)
+            continue;
+        const long int p95 = (median < 0) ? MAX_UX_TIMEOUT * 1000L : latencies_.quantile(handler->id, 0.95);
+        timeout = std::max(timeout, p95);
+        awaited.insert(handler);
+    }
+    if (awaited.empty())
+        return MAX_UX_TIMEOUT;
+    return static_cast<int>(std::min<long int>(MAX_UX_TIMEOUT, std::max<long int>(MIN_UX_TIMEOUT, (timeout + 999) / 1000)));
+}
+
+
+
+/** ***************************************************************************/
+void QueryScheduler::recordRuntimes(const std::map<AbstractExtension*, long int> &runtimes) {
+    latencies_.record(runtimes);
+}
+
+
+
+/** ***************************************************************************/
+void QueryScheduler::loadRuntimes() {
+    latencies_.load();
+}
@@ -0,0 +1,98 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QFuture>
+#include <QFutureInterface>
+#include <QMutex>
+#include <QThreadPool>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+#include "latencymodel.h"
+class AbstractExtension;
+class CancellationToken;
+
+/**
+ * @brief The QueryScheduler class
+ * Runs the query handlers in a pool of its own, apart from background work
+ * like indexing. The jobs of the newest query run first, the jobs of stale
+ * queries are dropped without being run. An extension handles at most
+ * maxConcurrentQueries queries at once, further jobs wait. Thread safe,
+ * except for the latency estimation which is up to the GUI thread.
+ */
+class QueryScheduler final
+{
+public:
+
+    QueryScheduler();
+    ~QueryScheduler();
+
+    /**
+     * Schedules a handler of a query. The extension and the token have to
+     * outlive the job.
+     * @return The future of the job, finished when it ran or was dropped
+     */
+    QFuture<void> schedule(AbstractExtension *extension, const CancellationToken &token,
+                           std::function<void()> work);
+
+    /**
+     * Plans when to publish the results of a query, based on the recent
+     * runtimes of the handlers. Handlers whose median runtime exceeds
+     * MAX_UX_TIMEOUT are not waited for, their results are appended later.
+     * @param awaited The handlers to wait for. The results can be published
+     * as soon as they are done.
+     * @return The time in ms after which the results are published anyway
+     */
+    int uxTimeout(const std::vector<AbstractExtension*> &handlers, std::set<AbstractExtension*> &awaited) const;
+
+    /** Records the runtimes of the handlers of a query, in µs */
+    void recordRuntimes(const std::map<AbstractExtension*, long int> &runtimes);
+
+    /** Loads the recent runtimes */
+    void loadRuntimes();
+
+    // The bounds of the time to wait for results before publishing them, ms
+    static const int MIN_UX_TIMEOUT = 10;
+    static const int MAX_UX_TIMEOUT = 100;
+
+private:
+
+    struct Job {
+        uint64_t sequence;
+        AbstractExtension *extension;
+        const CancellationToken *token;
+        std::function<void()> work;
+        QFutureInterface<void> future;
+    };
+
+    class Runner;
+
+    void dispatch();
+    void finish(AbstractExtension *extension);
+
+    QThreadPool pool_;
+    QMutex mutex_;
+    std::vector<Job> queued_; // Ascending by sequence, the newest last
+    std::map<AbstractExtension*, int> inFlight_;
+    int running_;
+    uint64_t sequence_;
+
+    LatencyModel latencies_;
+
+};
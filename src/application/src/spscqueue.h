@@ -0,0 +1,95 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The SpscQueue class
+ * An unbounded, lock free queue for a single producer and a single consumer
+ * thread. The elements are stored in linked blocks, the producer publishes
+ * the filled slots of a block with a release store of its count.
+ */
+template<class T>
+class SpscQueue final
+{
+public:
+
+    SpscQueue() : head_(new Block), tail_(head_) {}
+
+    ~SpscQueue() {
+        while (head_) {
+            Block *next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /** Appends a value. Producer thread only. */
+    void push(T value) {
+        size_t count = tail_->count.load(std::memory_order_relaxed);
+        if (count == BLOCK_SIZE) {
+            Block *block = new Block;
+            tail_->next.store(block, std::memory_order_release);
+            tail_ = block;
+            count = 0;
+        }
+        tail_->values[count] = std::move(value);
+        tail_->count.store(count + 1, std::memory_order_release);
+    }
+
+    /** Moves the published values to out. Consumer thread only. */
+    void drain(std::vector<T> &out) {
+        for (;;) {
+            const size_t count = head_->count.load(std::memory_order_acquire);
+            for (; read_ < count; ++read_)
+                out.push_back(std::move(head_->values[read_]));
+            if (read_ < BLOCK_SIZE)
+                return;
+            // The block is consumed, the producer moved on if there is a next
+            Block *next = head_->next.load(std::memory_order_acquire);
+            if (!next)
+                return;
+            delete head_;
+            head_ = next;
+            read_ = 0;
+        }
+    }
+
+private:
+
+    static const size_t BLOCK_SIZE = 256;
+
+    struct Block {
+        T values[BLOCK_SIZE];
+        std::atomic<size_t> count{0};
+        std::atomic<Block*> next{nullptr};
+    };
+
+    // Consumer side
+    Block *head_;
+    size_t read_ = 0;
+
+    // Producer side
+    Block *tail_;
+
+};
@@ -0,0 +1,261 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QDebug>
+#include <QReadLocker>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QWriteLocker>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include "usagemodel.h"
+
+namespace {
+
+const char *CONNECTION = "usagemodel";
+const qint64 MSECS_PER_DAY = 24 * 3600 * 1000;
+
+// Runs a function in a thread pool
+class Task final : public QRunnable
+{
+public:
+    explicit Task(std::function<void()> function) : function_(function) {}
+    void run() override { function_(); }
+private:
+    std::function<void()> function_;
+};
+
+}
+
+const double UsageModel::HALF_LIFE_DAYS = 7;
+const qint64 UsageModel::DECAY_INTERVAL = 3600 * 1000;
+const int UsageModel::MAX_PREFIX = 32;
+
+
+/** ***************************************************************************/
+UsageModel::UsageModel() : trie_(1), decayedAt_(QDateTime::currentMSecsSinceEpoch()) {
+    // The tasks use a connection of their own, connections are per thread
+    pool_.setMaxThreadCount(1);
+    databaseName_ = QSqlDatabase::database().databaseName();
+}
+
+
+
+/** ***************************************************************************/
+UsageModel::~UsageModel() {
+    // Write what is left, the pool does not use the connection anymore
+    pool_.waitForDone();
+    flush();
+}
+
+
+
+/** ***************************************************************************/
+void UsageModel::load() {
+    pool_.start(new Task([this](){
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", CONNECTION);
+            db.setDatabaseName(databaseName_);
+            if (!db.open()) {
+                qWarning() << "Unable to load the usages:" << db.lastError();
+            } else {
+                // Sum up the decayed weights of the activations
+                const qint64 now = QDateTime::currentMSecsSinceEpoch();
+                QSqlQuery query(db);
+                query.exec("SELECT itemId, input, (julianday('now')-julianday(timestamp)) FROM usages");
+                while (query.next()) {
+                    const qint64 lastUse = now - static_cast<qint64>(query.value(2).toDouble() * MSECS_PER_DAY);
+                    add(query.value(0).toString(), query.value(1).toString(), lastUse);
+                }
+            }
+        }
+        QSqlDatabase::removeDatabase(CONNECTION);
+    }));
+}
+
+
+
+/** ***************************************************************************/
+void UsageModel::record(const QString &itemId, const QString &input) {
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    add(itemId, input, now.toMSecsSinceEpoch());
+
+    // Same format as CURRENT_TIMESTAMP
+    QMutexLocker locker(&pendingMutex_);
+    pending_.push_back(Row{input, itemId, now.toString("yyyy-MM-dd HH:mm:ss")});
+    if (pending_.size() == 1)
+        pool_.start(new Task([this](){ flush(); }));
+}
+
+
+
+/** ***************************************************************************/
+void UsageModel::decay() {
+    // Rebase the scores to now. Cheap, the number of used items is small.
+    QWriteLocker locker(&lock_);
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - decayedAt_ < DECAY_INTERVAL)
+        return;
+    const double factor = weight(now);
+    for (Entry &entry : entries_)
+        entry.score *= factor;
+    for (Node &node : trie_) {
+        if (!node.counts)
+            continue;
+        if (!node.counts.unique())
+            node.counts = std::make_shared<PrefixCounts>(*node.counts);
+        for (std::pair<uint32_t, double> &count : *node.counts)
+            count.second *= factor;
+    }
+    decayedAt_ = now;
+}
+
+
+
+/** ***************************************************************************/
+std::shared_ptr<const UsageModel::PrefixCounts> UsageModel::prefixCounts(const QString &input) const {
+    static const std::shared_ptr<const PrefixCounts> empty = std::make_shared<const PrefixCounts>();
+    const QString prefix = normalized(input);
+    QReadLocker locker(&lock_);
+    uint32_t node = 0;
+    for (int i = 0; i < prefix.size(); ++i) {
+        const std::vector<std::pair<ushort, uint32_t>> &children = trie_[node].children;
+        std::vector<std::pair<ushort, uint32_t>>::const_iterator it
+                = std::lower_bound(children.begin(), children.end(), std::make_pair(prefix[i].unicode(), uint32_t(0)));
+        if (it == children.end() || it->first != prefix[i].unicode())
+            return empty;
+        node = it->second;
+    }
+    return (node == 0 || !trie_[node].counts) ? empty : trie_[node].counts;
+}
+
+
+
+/** ***************************************************************************/
+bool UsageModel::lookup(const QString &itemId, const PrefixCounts &prefix,
+                        double &score, double &recency, double &prefixScore) const {
+    QReadLocker locker(&lock_);
+    std::unordered_map<QString, uint32_t, Hash>::const_iterator it = ids_.find(itemId);
+    if (it == ids_.end())
+        return false;
+    const Entry &entry = entries_[it->second];
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    const double factor = weight(now);
+    score = entry.score * factor;
+    recency = 1.0 / std::max(static_cast<double>(now - entry.lastUse) / MSECS_PER_DAY, 1.0);
+    PrefixCounts::const_iterator count
+            = std::lower_bound(prefix.begin(), prefix.end(), std::make_pair(it->second, 0.0));
+    if (count != prefix.end() && count->first == it->second)
+        prefixScore = count->second * factor;
+    return true;
+}
+
+
+
+/** ***************************************************************************/
+void UsageModel::add(const QString &itemId, const QString &input, qint64 lastUse) {
+    const QString prefix = normalized(input);
+    QWriteLocker locker(&lock_);
+    std::pair<std::unordered_map<QString, uint32_t, Hash>::iterator, bool> it
+            = ids_.emplace(itemId, static_cast<uint32_t>(entries_.size()));
+    const uint32_t id = it.first->second;
+    if (it.second)
+        entries_.push_back(Entry{0, lastUse});
+    const double score = 1 / weight(lastUse);
+    Entry &entry = entries_[id];
+    entry.score += score;
+    entry.lastUse = std::max(entry.lastUse, lastUse);
+
+    // Count the activation in the nodes of all prefixes of the input
+    uint32_t node = 0;
+    for (int i = 0; i < prefix.size(); ++i) {
+        std::vector<std::pair<ushort, uint32_t>> &children = trie_[node].children;
+        const std::pair<ushort, uint32_t> key(prefix[i].unicode(), 0);
+        std::vector<std::pair<ushort, uint32_t>>::iterator child
+                = std::lower_bound(children.begin(), children.end(), key);
+        if (child == children.end() || child->first != key.first) {
+            child = children.insert(child, std::make_pair(key.first, static_cast<uint32_t>(trie_.size())));
+            node = child->second;
+            trie_.emplace_back(); // Invalidates children
+        } else
+            node = child->second;
+
+        // The queries share the counts, copy them if one still uses them
+        std::shared_ptr<PrefixCounts> &shared = trie_[node].counts;
+        if (!shared)
+            shared = std::make_shared<PrefixCounts>();
+        else if (!shared.unique())
+            shared = std::make_shared<PrefixCounts>(*shared);
+        PrefixCounts &counts = *shared;
+        PrefixCounts::iterator count = std::lower_bound(counts.begin(), counts.end(), std::make_pair(id, 0.0));
+        if (count == counts.end() || count->first != id)
+            counts.insert(count, std::make_pair(id, score));
+        else
+            count->second += score;
+    }
+}
+
+
+
+/** ***************************************************************************/
+QString UsageModel::normalized(const QString &input) {
+    return input.left(MAX_PREFIX).toLower();
+}
+
+
+
+/** ***************************************************************************/
+void UsageModel::flush() {
+    std::vector<Row> rows;
+    {
+        QMutexLocker locker(&pendingMutex_);
+        rows.swap(pending_);
+    }
+    if (rows.empty())
+        return;
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", CONNECTION);
+        db.setDatabaseName(databaseName_);
+        if (!db.open()) {
+            qWarning() << "Unable to save the usages:" << db.lastError();
+        } else {
+            db.transaction();
+            QSqlQuery query(db);
+            query.prepare("INSERT INTO usages (input, itemId, timestamp) VALUES (:input, :itemId, :timestamp);");
+            for (const Row &row : rows) {
+                query.bindValue(":input", row.input);
+                query.bindValue(":itemId", row.itemId);
+                query.bindValue(":timestamp", row.timestamp);
+                if (!query.exec())
+                    qWarning() << query.lastError();
+            }
+            db.commit();
+        }
+    }
+    QSqlDatabase::removeDatabase(CONNECTION);
+}
+
+
+
+/** ***************************************************************************/
+double UsageModel::weight(qint64 msecs) const {
+    // The weight of a point in time relative to decayedAt_
+    return std::exp2(-static_cast<double>(msecs - decayedAt_) / (HALF_LIFE_DAYS * MSECS_PER_DAY));
+}
@@ -0,0 +1,121 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QString>
+#include <QThreadPool>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief The UsageModel class
+ * The recency weighted activation counts of the items, kept in memory. Every
+ * activation counts one, halving every HALF_LIFE_DAYS. Activations are
+ * recorded in constant time and written to the database in the background.
+ * The history is loaded from the database in the background too. Thread safe.
+ *
+ * The counts are also kept per input: a trie of the inputs the items were
+ * activated with holds the counts of the inputs starting with each prefix.
+ */
+class UsageModel final
+{
+public:
+
+    /** The activations of the items for a prefix, sorted by interned id */
+    typedef std::vector<std::pair<uint32_t, double>> PrefixCounts;
+
+    UsageModel();
+    ~UsageModel();
+
+    /** Loads the usages of the database, asynchronously */
+    void load();
+
+    /** Records an activation of the item */
+    void record(const QString &itemId, const QString &input);
+
+    /** Applies the decay since the last call, if it is due */
+    void decay();
+
+    /**
+     * Returns the activations for the inputs starting with input, O(|input|).
+     * Shared, not copied. Later activations do not modify it.
+     */
+    std::shared_ptr<const PrefixCounts> prefixCounts(const QString &input) const;
+
+    /**
+     * Looks up the usage of an item
+     * @param prefix The activations for the current input
+     * @param score The decayed sum of the activations
+     * @param recency 1/days since the last activation, at most 1
+     * @param prefixScore The decayed sum of the activations for the input
+     * @return False if the item has never been activated
+     */
+    bool lookup(const QString &itemId, const PrefixCounts &prefix,
+                double &score, double &recency, double &prefixScore) const;
+
+private:
+
+    struct Entry {
+        double score;     // Relative to decayedAt_
+        qint64 lastUse;   // Msecs since epoch
+    };
+
+    struct Row {
+        QString input;
+        QString itemId;
+        QString timestamp;
+    };
+
+    struct Node {
+        std::vector<std::pair<ushort, uint32_t>> children; // Sorted by character
+        std::shared_ptr<PrefixCounts> counts;              // Relative to decayedAt_, copied on write
+    };
+
+    struct Hash {
+        size_t operator()(const QString &s) const { return qHash(s); }
+    };
+
+    void add(const QString &itemId, const QString &input, qint64 lastUse);
+    static QString normalized(const QString &input);
+    void flush();
+    double weight(qint64 msecs) const;
+
+    static const double HALF_LIFE_DAYS;
+    static const qint64 DECAY_INTERVAL;
+    static const int MAX_PREFIX;
+
+    // The item ids are interned, the entries are indexed by the interned id
+    mutable QReadWriteLock lock_;
+    std::unordered_map<QString, uint32_t, Hash> ids_;
+    std::vector<Entry> entries_;
+    std::vector<Node> trie_;
+    qint64 decayedAt_;
+
+    // The activations not written yet
+    QMutex pendingMutex_;
+    std::vector<Row> pending_;
+
+    // Runs the database tasks one after another, in order
+    QThreadPool pool_;
+    QString databaseName_;
+
+};
@@ -71,6 +71,13 @@ public:
      */
     virtual QStringList triggers() const {return QStringList();}
 
+    /**
+     * @brief The maximal number of queries handled at once
+     * Further queries wait until one of the running ones returned. Queries
+     * invalidated meanwhile are dropped without being handled.
+     */
+    virtual int maxConcurrentQueries() const { return 2; }
+
     /**
      * @brief Session setup
      * Called when the users started a session, i.e. before the the main window
@@ -95,14 +102,25 @@ public:
      * This method is called for every user input. Add the results to the query
      * passed as parameter. The results are sorted by usage. After 100 ms
      * they are just appended to not disturb the users interaction. Queries can
-     * get invalidated so make sure to regularly check isValid() to cancel
-     * long running operations. This method is called in a thread without event
-     * loop, be aware of the consequences (especially regarding signal/slot
-     * mechanism).
+     * get invalidated or expire so make sure to regularly check the token() to
+     * cancel long running operations. This method is called in a thread
+     * without event loop, be aware of the consequences (especially regarding
+     * signal/slot mechanism).
      * @param query Holds the query context
      */
     virtual void handleQuery(AbstractQuery *query) { Q_UNUSED(query) }
 
+    /**
+     * @brief Further matches of a query
+     * Called when the user scrolled to the end of the results, after all
+     * handlers of the query finished. Add the matches following the ones
+     * added by handleQuery, or nothing if there are no more. Called in a
+     * thread without event loop, like handleQuery. The token() of the query
+     * may have expired meanwhile, check isValid() instead.
+     * @param query The query handled before
+     */
+    virtual void handleQueryMore(AbstractQuery *query) { Q_UNUSED(query) }
+
     /**
      * @brief Fallbacks of this extension
      * This items show up if a query yields no results
@@ -15,8 +15,10 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
+#include <cstdint>
 #include "core_globals.h"
 #include "abstractitem.h"
+#include "cancellationtoken.h"
 
 /**
  * @brief The Query class
@@ -46,10 +48,27 @@ public:
     virtual bool isValid() const = 0;
 
 
+    /**
+     * @brief The cancellation token of the query
+     * Cancelled when the query is invalidated, expires at the deadline of the
+     * query. Handlers should poll stopRequested in long loops and pass the
+     * token to searches of an OfflineIndex.
+     */
+    virtual const CancellationToken &token() const = 0;
+
+
     /**
      * @brief Returns the search term of this query
      */
     virtual const QString & searchTerm() const = 0;
 
+
+    /**
+     * @brief Returns the id of the session of this query
+     * Unique per session, never 0. Handlers pass it to the searches of an
+     * OfflineIndex, consecutive queries of a session reuse their candidates.
+     */
+    virtual uint64_t session() const = 0;
+
 };
 
@@ -0,0 +1,45 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "core_globals.h"
+class QRunnable;
+class QThreadPool;
+
+/**
+ * @brief The BackgroundPool class
+ * The thread pool for long running background work like indexing. It is kept
+ * apart from the pools answering queries, such that a long indexing run does
+ * not delay the results. Its threads run at idle priority.
+ */
+class EXPORT_CORE BackgroundPool final
+{
+public:
+
+    /**
+     * @brief Runs a job in the background pool
+     * The pool takes ownership of the runnable if autoDelete is set, just like
+     * QThreadPool::start.
+     * @param runnable The job to run
+     */
+    static void start(QRunnable *runnable);
+
+    /**
+     * @brief The pool, e.g. to wait for the jobs
+     */
+    static QThreadPool *instance();
+
+};
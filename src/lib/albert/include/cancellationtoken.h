@@ -0,0 +1,71 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+
+/**
+ * @brief The CancellationToken class
+ * Tells long running work to stop. The work polls the token, it is cancelled
+ * explicitly by its owner or expires at its deadline. The deadline has to be
+ * set before the token is shared with other threads.
+ */
+class CancellationToken final
+{
+public:
+
+    typedef std::chrono::steady_clock Clock;
+
+    CancellationToken() : cancelled_(false), deadline_(Clock::time_point::max()) {}
+
+    /** Cancels the work. Thread safe. */
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+    /** True if the work was cancelled, its results are discarded anyway */
+    bool isCancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+    /** Sets the point in time the work should be done by */
+    void setDeadline(Clock::time_point deadline) { deadline_ = deadline; }
+
+    /** The point in time the work should be done by */
+    Clock::time_point deadline() const { return deadline_; }
+
+    /** True if the deadline passed */
+    bool isExpired() const {
+        return deadline_ != Clock::time_point::max() && Clock::now() >= deadline_;
+    }
+
+    /** True if the work should stop, i.e. it is cancelled or expired */
+    bool stopRequested() const { return isCancelled() || isExpired(); }
+
+    /** The time left until the deadline, zero if the work should stop */
+    std::chrono::milliseconds remaining() const {
+        if (isCancelled())
+            return std::chrono::milliseconds(0);
+        if (deadline_ == Clock::time_point::max())
+            return std::chrono::milliseconds::max();
+        return std::max(std::chrono::milliseconds(0),
+                        std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - Clock::now()));
+    }
+
+private:
+
+    std::atomic<bool> cancelled_;
+    Clock::time_point deadline_;
+
+};
@@ -136,6 +136,7 @@ public:
     QWidget *widget(QWidget *parent = nullptr) override;
     bool runExclusive() const override;
     QStringList triggers() const override;
+    int maxConcurrentQueries() const override;
     void setupSession() override;
     void teardownSession() override;
     void handleQuery(AbstractQuery* query) override;
@@ -16,15 +16,48 @@
 
 #pragma once
 #include <QString>
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include <utility>
+#include <QMutex>
 #include "core_globals.h"
 class IndexImpl;
+class CancellationToken;
 class IIndexable;
+struct SearchCache;
 
+/**
+ * @brief The OfflineIndex class
+ * Modifications are serialized and published as immutable snapshots. Searches
+ * run on the latest snapshot and never block, not even while the index is
+ * modified by another thread.
+ */
 class EXPORT_CORE OfflineIndex final {
 
 public:
+
+    /**
+     * @brief Statistics of the fuzzy search
+     * The counts accumulate over all searches. A candidate is a word sharing
+     * q-grams with a query word. Most of them should be pruned by the cheap
+     * filters before the edit distance is verified.
+     */
+    struct FuzzyStats {
+        uint64_t words = 0;          // The number of query words searched
+        uint64_t candidates = 0;     // The candidate words
+        uint64_t countFiltered = 0;  // Pruned, too few common q-grams
+        uint64_t lengthFiltered = 0; // Pruned, too short
+        uint64_t truncated = 0;      // Pruned, not among the best candidates
+        uint64_t verified = 0;       // Checked by edit distance
+        uint64_t matched = 0;        // Within the error tolerance
+
+        /** The fraction of the candidates pruned without verification */
+        double pruningRatio() const {
+            return (candidates == 0) ? 0 : 1.0 - static_cast<double>(verified) / candidates;
+        }
+    };
+
     /**
      * @brief Contstructs a search
      * @param fuzzy Sets the type of the search. Defaults to false.
@@ -68,24 +101,134 @@ public:
     double delta();
 
     /**
-     * @brief Build the search index
+     * @brief Add an item to the search index
+     * Every call rebuilds the index of the changes since the last merge and
+     * publishes a new snapshot, so adding n items one by one costs O(n²).
+     * Batches must go through applyDelta.
      * @param The items to index
      */
     void add(std::shared_ptr<IIndexable> idxble);
 
+    /**
+     * @brief Remove an item from the search index
+     * Publishes a new snapshot like add, use applyDelta for batches.
+     * @param idxble The item to remove
+     */
+    void remove(std::shared_ptr<IIndexable> idxble);
+
+    /**
+     * @brief Reindex an item whose keywords changed
+     * Publishes a new snapshot like add, use applyDelta for batches.
+     * @param idxble The item to update
+     */
+    void update(std::shared_ptr<IIndexable> idxble);
+
+    /**
+     * @brief Apply a batch of changes to the search index
+     * The cost depends on the size of the changes, not on the size of the
+     * index. Occasionally the accumulated changes are merged into the main
+     * index, which is linear in the size of the index.
+     * @param added The items to add
+     * @param removed The items to remove
+     */
+    void applyDelta(const std::vector<std::shared_ptr<IIndexable>> &added,
+                    const std::vector<std::shared_ptr<IIndexable>> &removed);
+
     /**
      * @brief Clear the search index
      */
     void clear();
 
+    /**
+     * @brief Save the index to a file
+     * The file is versioned and checksummed. The items are not saved, the ids
+     * of the saved index are the positions of the items in the given vector.
+     * Indexed items not in there are not saved.
+     * @param path The file to write, replaced atomically
+     * @param items The items in the order they will be passed to load
+     * @return True on success
+     */
+    bool save(const QString &path, const std::vector<std::shared_ptr<IIndexable>> &items);
+
+    /**
+     * @brief Replace the index by a saved one
+     * The file is memory mapped, not parsed. Fails on version, checksum or item
+     * count mismatch, in this case the index is left untouched.
+     * @param path The file written by save
+     * @param items The items, in the order they were passed to save
+     * @return True on success
+     */
+    bool load(const QString &path, const std::vector<std::shared_ptr<IIndexable>> &items);
+
+    /**
+     * @brief The statistics of the fuzzy search
+     * @return The counts since the search became fuzzy, zero if it is not.
+     */
+    FuzzyStats fuzzyStats() const;
+
     /**
      * @brief Perform a search on the index
+     * Thread safe, lock free. Queries extending the last query of the same
+     * session are answered by filtering its matches where that is cheaper.
+     * The score of a match (0..SHRT_MAX) reflects the relevance of the
+     * matching keywords, the match type (exact, prefix, fuzzy) and the
+     * fraction of the matching words covered by the query.
      * @param req The query string
+     * @param token Stops the search early if set, a stopped search has no matches
+     * @param session The session of the query, see AbstractQuery::session. 0 disables the cache.
+     * @return The matching items and their scores
      */
-    std::vector<std::shared_ptr<IIndexable>> search(const QString &req) const;
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>> search(const QString &req,
+                                                                      const CancellationToken *token = nullptr,
+                                                                      uint64_t session = 0) const;
+
+    /**
+     * @brief Perform a search on the index returning the best matches only
+     * Cheaper than a full search, single word queries stop scanning as soon
+     * as no further match can make it into the results. Use searchMore to
+     * get the subsequent matches.
+     * @param req The query string
+     * @param k The number of matches to return
+     * @param token Stops the search early if set, a stopped search has no matches
+     * @param session The session of the query, see AbstractQuery::session. 0 disables the cache.
+     * @return The best k matches, sorted by descending score
+     */
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>> search(const QString &req, size_t k,
+                                                                      const CancellationToken *token = nullptr,
+                                                                      uint64_t session = 0) const;
+
+    /**
+     * @brief Continue the last top k search of a session
+     * Works on the index as it was at the time of the search. Every call
+     * returns the matches following the ones returned so far.
+     * @param req The query string of the search to continue
+     * @param k The number of further matches to return
+     * @param session The session of the search, see AbstractQuery::session
+     * @return The next k matches, sorted by descending score. Empty if there
+     * are no more or if the last top k search of the session was another one.
+     */
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>> searchMore(const QString &req, size_t k,
+                                                                          uint64_t session) const;
 
 private:
+
+    struct Session;
+
+    void publish();
+    Session *findSession(uint64_t id, bool create) const;
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>>
+    cachedSearch(const std::shared_ptr<const IndexImpl> &snapshot, const QString &req, size_t k,
+                 const CancellationToken *token, uint64_t session) const;
+
     IndexImpl *impl_;
+    std::shared_ptr<const IndexImpl> snapshot_;
+    QMutex writeMutex_;
+
+    // The state of the last searches per session, most recent first. A few
+    // sessions only, e.g. the launcher and a concurrent caller.
+    mutable std::vector<std::unique_ptr<Session>> sessions_;
+    mutable QMutex sessionMutex_;
+    static const size_t MAX_SESSIONS = 4;
 };
 
 
@@ -16,7 +16,12 @@
 
 #pragma once
 #include "prefixsearch.hpp"
+#include "prefixeditdistance.h"
+#include "qgramindex.h"
+#include "offlineindex.h"
 #include <QString>
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <vector>
 #include <memory>
@@ -29,19 +34,18 @@ class FuzzySearch final : public PrefixSearch {
 public:
 
     /** ***********************************************************************/
-    explicit FuzzySearch(unsigned int q = 3, double d = 2) : q_(q), delta_(d) {
+    explicit FuzzySearch(unsigned int q = 3, double d = 2)
+        : baseQGrams_(std::make_shared<const QGramIndex>()),
+          deltaQGrams_(std::make_shared<const QGramIndex>()), q_(q), delta_(d) {
     }
 
 
 
     /** ***********************************************************************/
     explicit FuzzySearch(const PrefixSearch& rhs, unsigned int q = 3, double d = 2) : PrefixSearch(rhs), q_(q), delta_(d) {
-        // Iterate over the inverted index and build the qGramindex
-        for (typename PrefixSearch::InvertedIndex::const_iterator it = this->invertedIndex_.cbegin(); it != this->invertedIndex_.cend(); ++it) {
-            QString spaced = QString(q_-1,' ').append(it->first);
-            for (unsigned int i = 0 ; i < static_cast<unsigned int>(it->first.size()); ++i)
-                ++qGramIndex_[spaced.mid(i,q_)][it->first];
-        }
+        // Build the qGram indices of the terms of the inverted indices
+        baseQGrams_ = std::make_shared<const QGramIndex>(*base_, q_);
+        deltaQGrams_ = std::make_shared<const QGramIndex>(*deltaIndex_, q_);
     }
 
 
@@ -53,104 +57,181 @@ public:
 
 
     /** ***********************************************************************/
-    void add(shared_ptr<IIndexable> idxble) override {
-        // Add a mappings to the inverted index which maps on t.
-        std::vector<IIndexable::WeightedKeyword> indexKeywords = idxble->indexKeywords();
-        for (const auto &wkw : indexKeywords) {
-            QStringList words = wkw.keyword.split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts);
-             for (QString &w : words) {
-
-                // Make this search case insensitive
-                w=w.toLower();
-
-                // Add word to inverted index (map word to item)
-                this->invertedIndex_[w].insert(idxble);
-
-                // Build a qGram index (map substring to word)
-                QString spaced = QString(q_-1,' ').append(w);
-                for (unsigned int i = 0 ; i < static_cast<unsigned int>(w.size()); ++i)
-                    ++qGramIndex_[spaced.mid(i,q_)][w]; //FIXME Currently occurences are not uses
-            }
-        }
+    void build() override {
+        shared_ptr<const TermIndex> base = base_;
+        shared_ptr<const TermIndex> delta = deltaIndex_;
+        PrefixSearch::build();
+
+        // Rebuild the qGrams of the term indices that changed
+        if (base_ != base)
+            baseQGrams_ = std::make_shared<const QGramIndex>(*base_, q_);
+        if (deltaIndex_ != delta)
+            deltaQGrams_ = std::make_shared<const QGramIndex>(*deltaIndex_, q_);
     }
 
 
+
+    /** ***********************************************************************/
+    void assign(const vector<shared_ptr<IIndexable>> &items, shared_ptr<const TermIndex> index) override {
+        PrefixSearch::assign(items, index);
+        baseQGrams_ = std::make_shared<const QGramIndex>(*base_, q_);
+        deltaQGrams_ = std::make_shared<const QGramIndex>();
+    }
+
+
+
     /** ***********************************************************************/
     void clear() override {
-        this->invertedIndex_.clear();
-        qGramIndex_.clear();
+        PrefixSearch::clear();
+        baseQGrams_ = std::make_shared<const QGramIndex>();
+        deltaQGrams_ = std::make_shared<const QGramIndex>();
     }
 
 
 
     /** ***********************************************************************/
-    vector<shared_ptr<IIndexable>> search(const QString &req) const override {
-        vector<QString> words;
-        for (QString &word : req.split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts))
-            words.push_back(word.toLower());
-        vector<map<shared_ptr<IIndexable>, unsigned int>> resultsPerWord;
+    shared_ptr<const IndexImpl> snapshot() const override {
+        shared_ptr<FuzzySearch> snapshot = std::make_shared<FuzzySearch>(q_, delta_);
+        snapshot->assignSearchState(*this);
+        snapshot->baseQGrams_ = baseQGrams_;
+        snapshot->deltaQGrams_ = deltaQGrams_;
+        snapshot->counters_ = counters_;
+        return snapshot;
+    }
+
+
+
+    /** ***********************************************************************/
+    vector<std::pair<shared_ptr<IIndexable>, short>> search(const QString &req, size_t k,
+                                                            SearchCache *cache,
+                                                            const CancellationToken *token) const override {
+        // Extending a word can change the error tolerance, the matches are
+        // not necessarily a subset of the last ones. Do not cache.
+        if (cache)
+            cache->words.clear();
+
+        vector<QString> words = Tokenizer::words(req);
+        vector<map<uint32_t, unsigned int>> resultsPerWord;
 
         // Quit if there are no words in query
-        if (words.empty())
-            return vector<shared_ptr<IIndexable>>();
+        if (words.empty() || k == 0)
+            return vector<std::pair<shared_ptr<IIndexable>, short>>();
+
+        static thread_local vector<QGramIndex::Gram> qGrams;
+        static thread_local vector<Candidate> candidates;
+        vector<TermIndex::Posting> postings;
+        Counters &counters = *counters_;
 
         // Split the query into words
         for (QString &word : words) {
+            if (stopRequested(token))
+                return vector<std::pair<shared_ptr<IIndexable>, short>>();
             unsigned int delta = static_cast<unsigned int>((delta_ < 1)? word.size()/delta_ : delta_);
 
             // Generate the qGrams of this word
-            map<QString, unsigned int> qGrams;
-            QString spaced(q_-1,' ');
-            spaced.append(word.toLower());
-            for (unsigned int i = 0 ; i < static_cast<unsigned int>(word.size()); ++i)
-                ++qGrams[spaced.mid(i,q_)];
+            QGramIndex::grams(word.constData(), word.size(), q_, qGrams);
+
+            // An edit destroys at most q of the qGrams of the word, and the
+            // prefix of a match is at least as long as the word minus delta
+            const unsigned int length = static_cast<unsigned int>(word.size());
+            const unsigned int minMatches = (length > q_ * delta) ? length - q_ * delta : 1;
+            const int minLength = static_cast<int>((length > delta) ? length - delta : 0);
 
             // Get the words referenced by each qGram an increment their
-            // reference counter
-            // Iterate over the set of qgrams in the word
-            map<QString, unsigned int> wordMatches;
-            for (map<QString, unsigned int>::const_iterator it = qGrams.cbegin(); it != qGrams.end(); ++it) {
+            // reference counter. Keep the best candidates in a bounded heap.
+            candidates.clear();
+            uint64_t wordCandidates = 0, countFiltered = 0, lengthFiltered = 0, truncated = 0;
+            for (const std::pair<const TermIndex*, const QGramIndex*> &index
+                 : {std::make_pair(base_.get(), baseQGrams_.get()),
+                    std::make_pair(deltaIndex_.get(), deltaQGrams_.get())}) {
+                const TermIndex &terms = *index.first;
+
+                // matches is zero, except for the touched words
+                static thread_local vector<uint32_t> matches;
+                static thread_local vector<uint32_t> touched;
+                if (matches.size() < terms.size())
+                    matches.resize(terms.size(), 0);
+                touched.clear();
+                for (const QGramIndex::Gram &qGram : qGrams) {
+                    std::pair<uint32_t, uint32_t> range = index.second->find(qGram.first);
+                    for (uint32_t e = range.first; e != range.second; ++e) {
+                        uint32_t t = index.second->term(e);
+                        if (matches[t] == 0)
+                            touched.push_back(t);
+                        // CRUCIAL: The match can contain only the commom amount of qGrams
+                        matches[t] += std::min(qGram.second, index.second->count(e));
+                    }
+                }
 
-                // Check for existance (std::map::at throws)
-                if (qGramIndex_.count(it->first) == 0)
-                    continue;
+                wordCandidates += touched.size();
+                for (uint32_t t : touched) {
+                    Candidate candidate{matches[t], t, &terms};
+                    matches[t] = 0;
+
+                    // Do some kind of (cheap) preselection by mathematical bound
+                    if (candidate.matches < minMatches) {
+                        ++countFiltered;
+                        continue;
+                    }
+                    if (terms.termSize(t) < minLength) {
+                        ++lengthFiltered;
+                        continue;
+                    }
 
-                // Iterate over the set of words referenced by this qGram
-                for (map<QString, unsigned int>::const_iterator wit = qGramIndex_.at(it->first).cbegin();
-                     wit != qGramIndex_.at(it->first).cend(); ++wit) {
-                    // CRUCIAL: The match can contain only the commom amount of qGrams
-                    wordMatches[wit->first] += (it->second < wit->second) ? it->second : wit->second;
+                    candidates.push_back(candidate);
+                    std::push_heap(candidates.begin(), candidates.end());
+                    if (candidates.size() > MAX_CANDIDATES) {
+                        std::pop_heap(candidates.begin(), candidates.end());
+                        candidates.pop_back();
+                        ++truncated;
+                    }
                 }
             }
 
             // Allocate a new set
-            resultsPerWord.push_back(map<shared_ptr<IIndexable>, unsigned int>());
-            map<shared_ptr<IIndexable>, unsigned int>& resultsRef = resultsPerWord.back();
+            resultsPerWord.push_back(map<uint32_t, unsigned int>());
+            map<uint32_t, unsigned int>& resultsRef = resultsPerWord.back();
 
-            // Unite the items referenced by the words accumulating their #matches
-            for (map<QString, unsigned int>::const_iterator wm = wordMatches.begin(); wm != wordMatches.end(); ++wm) {
-                //			// Do some kind of (cheap) preselection by mathematical bound
-                //			if (wm.value() < qGrams.size()-delta*_q)
-                //				continue;
+            // Unite the items referenced by the words keeping their best score
+            uint64_t matched = 0;
+            PrefixEditDistance prefixEditDistance(word);
+            for (const Candidate &candidate : candidates) {
+                if (stopRequested(token))
+                    return vector<std::pair<shared_ptr<IIndexable>, short>>();
 
                 // Now check the (expensive) prefix edit distance
-                if (!checkPrefixEditDistance(word, wm->first, delta))
+                const TermIndex &terms = *candidate.terms;
+                const int termSize = terms.termSize(candidate.term);
+                const unsigned int distance = prefixEditDistance.distance(terms.termData(candidate.term), termSize, delta);
+                if (distance > delta)
                     continue;
-
-                // Check for existance (std::map::at throws)
-                if (invertedIndex_.count(wm->first) == 0)
-                    continue;
-
-                for(const shared_ptr<IIndexable> &item : invertedIndex_.at(wm->first)) {
-                    resultsRef[item] += wm->second;
+                ++matched;
+
+                // Skip removed items
+                const double factor = matchFactor(word.size(), termSize, distance);
+                postings.clear();
+                terms.postings(candidate.term, postings);
+                for(const TermIndex::Posting &posting : postings) {
+                    if (!isRemoved(posting.id)) {
+                        unsigned int &score = resultsRef[posting.id];
+                        score = std::max(score, static_cast<unsigned int>(posting.relevance * factor));
+                    }
                 }
             }
+
+            counters.words += 1;
+            counters.candidates += wordCandidates;
+            counters.countFiltered += countFiltered;
+            counters.lengthFiltered += lengthFiltered;
+            counters.truncated += truncated;
+            counters.verified += candidates.size();
+            counters.matched += matched;
         }
 
         // Intersect the set of items references by the (referenced) words
         // This assusmes that there is at least one word (the query would not have
         // been started elsewise)
-        vector<std::pair<shared_ptr<IIndexable>, unsigned int>> finalResult;
+        vector<std::pair<uint32_t, unsigned int>> finalResult;
         if (resultsPerWord.size() > 1) {
             // Get the smallest list for intersection (performance)
             unsigned int smallest=0;
@@ -159,7 +240,7 @@ public:
                     smallest = i;
 
             bool allResultsContainEntry;
-            for (map<shared_ptr<IIndexable>, unsigned int>::const_iterator r = resultsPerWord[smallest].begin();
+            for (map<uint32_t, unsigned int>::const_iterator r = resultsPerWord[smallest].begin();
                  r != resultsPerWord[smallest].cend(); ++r) {
                 // Check if all results contain this entry
                 allResultsContainEntry=true;
@@ -171,7 +252,7 @@ public:
 
                     // If it is in: check next relutlist
                     if (resultsPerWord[i].find(r->first) != resultsPerWord[i].end() ) {
-                        // Accumulate matches
+                        // Accumulate scores
                         accMatches += resultsPerWord[i][r->first];
                         continue;
                     }
@@ -188,19 +269,33 @@ public:
                 finalResult.push_back(std::make_pair(r->first, accMatches));
             }
         } else {// Else do it without intersction
-            for (map<shared_ptr<IIndexable>, unsigned int>::const_iterator r = resultsPerWord[0].begin();
+            for (map<uint32_t, unsigned int>::const_iterator r = resultsPerWord[0].begin();
                  r != resultsPerWord[0].cend(); ++r)
                 finalResult.push_back(std::make_pair(r->first, r->second));
         }
 
-        // Sort em by relevance // TODO INTRODUCE RELEVANCE TO ITEMS
-        //        std::sort(finalResult.begin(), finalResult.end(),
-        //                  [](QPair<T, unsigned int> x, QPair<T, unsigned int> y)
-        //                    {return x.second > y.second;});
-        vector<shared_ptr<IIndexable>> result;
-        for (const std::pair<shared_ptr<IIndexable>, unsigned int> &pair : finalResult) {
-            result.push_back(pair.first);
+        // The score is the mean of the scores of the words
+        vector<std::pair<uint32_t, short>> scored;
+        scored.reserve(finalResult.size());
+        for (const std::pair<uint32_t, unsigned int> &pair : finalResult)
+            scored.emplace_back(pair.first, matchScore(pair.second, resultsPerWord.size()));
+
+        // Keep the best k. The ids are ascending in insertion order, ties
+        // keep it.
+        if (k != ALL) {
+            k = std::min(k, scored.size());
+            std::partial_sort(scored.begin(), scored.begin() + static_cast<std::ptrdiff_t>(k), scored.end(),
+                              [](const std::pair<uint32_t, short> &l, const std::pair<uint32_t, short> &r){
+                return l.second > r.second || (l.second == r.second && l.first < r.first);
+            });
+            scored.resize(k);
         }
+
+        // Resolve the item ids
+        vector<std::pair<shared_ptr<IIndexable>, short>> result;
+        result.reserve(scored.size());
+        for (const std::pair<uint32_t, short> &pair : scored)
+            result.emplace_back(item(pair.first), pair.second);
         return result;
     }
 
@@ -209,47 +304,49 @@ public:
     inline double delta() const {return delta_;}
     inline void setDelta(double d){delta_=d;}
 
-private:
+
     /** ***********************************************************************/
-    static bool checkPrefixEditDistance(const QString& prefix, const QString& str, unsigned int delta) {
-        bool result = false;
-        unsigned int n = prefix.size() + 1;
-        unsigned int m = std::min(prefix.size() + delta + 1, static_cast<unsigned int>(str.size()) + 1);
-        //      unsigned int matrix[n][m];
-        // This MAY throw an error
-        unsigned int* matrix = new unsigned int[n*m];
-
-        // Initialize left and top row.
-        //      for (unsigned int i = 0; i < n; ++i) { matrix[i][0] = i; }
-        //      for (unsigned int i = 0; i < m; ++i) { matrix[0][i] = i; }
-        for (unsigned int i = 0; i < n; ++i) { matrix[i*m+0] = i; }
-        for (unsigned int i = 0; i < m; ++i) { matrix[0*m+i] = i; }
-
-        // Now fill the whole matrix.
-        for (unsigned int i = 1; i < n; ++i) {
-            for (unsigned int j = 1; j < m; ++j) {
-                unsigned int dia = matrix[(i-1)*m+j-1] + (prefix[i-1] == str[j-1] ? 0 : 1);
-                matrix[i*m+j] = std::min(std::min(
-                                             dia,
-                                             matrix[i*m+j-1] + 1),
-                        matrix[(i-1)*m+j] + 1);
-            }
-        }
-        // Check the last row if there is an entry <= delta.
-        for (unsigned int j = 0; j < m; ++j) {
-            if (matrix[(n-1)*m+j] <= delta) {
-                result = true;
-                break;
-            }
-        }
-        delete[] matrix;
-        return result;
+    OfflineIndex::FuzzyStats stats() const {
+        OfflineIndex::FuzzyStats stats;
+        stats.words = counters_->words;
+        stats.candidates = counters_->candidates;
+        stats.countFiltered = counters_->countFiltered;
+        stats.lengthFiltered = counters_->lengthFiltered;
+        stats.truncated = counters_->truncated;
+        stats.verified = counters_->verified;
+        stats.matched = counters_->matched;
+        return stats;
     }
 
-    /** ***********************************************************************/
-    // Map of qGrams, containing their word references and #occurences
-    typedef map<QString, map<QString, unsigned int>> QGramIndex;
-    QGramIndex qGramIndex_;
+private:
+
+    // A word sharing qGrams with a query word. The heap keeps the worst on top.
+    struct Candidate {
+        uint32_t matches;
+        uint32_t term;
+        const TermIndex *terms;
+        bool operator<(const Candidate &rhs) const { return matches > rhs.matches; }
+    };
+
+    // The statistics of all snapshots of this index
+    struct Counters {
+        std::atomic<uint64_t> words{0};
+        std::atomic<uint64_t> candidates{0};
+        std::atomic<uint64_t> countFiltered{0};
+        std::atomic<uint64_t> lengthFiltered{0};
+        std::atomic<uint64_t> truncated{0};
+        std::atomic<uint64_t> verified{0};
+        std::atomic<uint64_t> matched{0};
+    };
+
+    // The maximal number of words verified per query word
+    static const size_t MAX_CANDIDATES = 1024;
+
+    // The qGrams of the terms of the base and the delta. Immutable, shared by snapshots.
+    shared_ptr<const QGramIndex> baseQGrams_;
+    shared_ptr<const QGramIndex> deltaQGrams_;
+
+    shared_ptr<Counters> counters_ = std::make_shared<Counters>();
 
     unsigned int q_; // Size of the slices
     double delta_; // Maximum error
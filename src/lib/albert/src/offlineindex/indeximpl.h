@@ -16,20 +16,71 @@
 
 #pragma once
 #include <QString>
+#include <climits>
+#include <cstdint>
 #include <vector>
 #include <memory>
+#include <utility>
+#include "cancellationtoken.h"
 class IIndexable;
+class IndexImpl;
 
+/**
+ * The candidates of the last search of a session. If the next query only
+ * extends the last word or appends a word, its matches are a subset of these
+ * and are found by filtering them.
+ */
+struct SearchCache
+{
+    std::shared_ptr<const IndexImpl> index; // The snapshot the candidates belong to
+    std::vector<QString> words;             // The lowercase query words, empty if invalid
+    std::vector<uint32_t> ids;              // The ascending ids of the matching items
+    std::vector<uint32_t> headScores;       // The summed scores of all but the last word
+    std::vector<uint16_t> lastScores;       // The scores of the last word
+};
 
 class IndexImpl
 {
 public:
+    static constexpr size_t ALL = SIZE_MAX;
+
     virtual ~IndexImpl(){}
     virtual void add(std::shared_ptr<IIndexable> idxble) = 0;
+    virtual void remove(const std::vector<std::shared_ptr<IIndexable>> &idxbles) = 0;
+    virtual void build() = 0;
     virtual void clear() = 0;
-    virtual std::vector<std::shared_ptr<IIndexable>> search(const QString &req) const = 0;
+    virtual std::shared_ptr<const IndexImpl> snapshot() const = 0;
+    /**
+     * Returns the best k matches sorted by score, or all matches unsorted if k
+     * is ALL. The cache of the session is used and updated if not null. If the
+     * token requests a stop the search returns early, without matches.
+     */
+    virtual std::vector<std::pair<std::shared_ptr<IIndexable>, short>> search(const QString &req, size_t k,
+                                                                              SearchCache *cache,
+                                                                              const CancellationToken *token) const = 0;
 
 protected:
-    static constexpr const char* SEPARATOR_REGEX  = "[!?<>\"'=+*.:,;\\\\\\/ _\\-]+";
+
+    /** True if the token is set and requests a stop */
+    static bool stopRequested(const CancellationToken *token) {
+        return token && token->stopRequested();
+    }
+
+    /**
+     * The quality of a term matching a query word. Exact matches keep the
+     * relevance of the keyword, prefixes are scaled by the fraction of the
+     * term they cover and every error halves, thirds... the score.
+     */
+    static double matchFactor(int wordSize, int termSize, unsigned int distance) {
+        double factor = 1.0 / (1 + distance);
+        if (termSize > wordSize)
+            factor *= 0.5 + 0.5 * wordSize / termSize;
+        return factor;
+    }
+
+    /** Maps the mean of the word scores (0..USHRT_MAX) to a match score */
+    static short matchScore(uint64_t wordScores, size_t words) {
+        return static_cast<short>(wordScores * SHRT_MAX / (static_cast<uint64_t>(USHRT_MAX) * words));
+    }
 
 };
@@ -0,0 +1,174 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "intersection.h"
+
+namespace {
+// Above this length ratio probing the long list beats scanning it
+const size_t GALLOP_RATIO = 32;
+// Below this length the setup of the block merge does not pay off
+const size_t SIMD_MIN_LENGTH = 16;
+}
+
+
+
+/** ***************************************************************************/
+size_t Intersection::intersect(const uint32_t *a, size_t na,
+                               const uint32_t *b, size_t nb,
+                               uint32_t *out) {
+    if (na == 0 || nb == 0)
+        return 0;
+
+    // Skewed lists: probe the long list for every element of the short one
+    if (na * GALLOP_RATIO < nb)
+        return gallop(a, na, b, nb, out);
+    if (nb * GALLOP_RATIO < na) {
+        // out may alias a only. Probing a for elements of b writes less or
+        // equal elements than already consumed of a, hence this is safe.
+        return gallop(b, nb, a, na, out);
+    }
+
+    // Dense lists of similar length
+    if (na >= SIMD_MIN_LENGTH && nb >= SIMD_MIN_LENGTH)
+        return simd(a, na, b, nb, out);
+    return merge(a, na, b, nb, out);
+}
+
+
+
+/** ***************************************************************************/
+void Intersection::intersect(const std::vector<std::vector<uint32_t>> &lists, size_t count,
+                             std::vector<uint32_t> &out) {
+    out.clear();
+    if (count == 0)
+        return;
+
+    // Smallest first. The result can only shrink, so intersecting the short
+    // lists first keeps the intermediate results small.
+    static thread_local std::vector<const std::vector<uint32_t>*> order;
+    order.clear();
+    for (size_t i = 0; i < count; ++i)
+        order.push_back(&lists[i]);
+    std::sort(order.begin(), order.end(),
+              [](const std::vector<uint32_t> *l, const std::vector<uint32_t> *r){
+        return l->size() < r->size();
+    });
+
+    // Intersect the two smallest into out, then the others in place
+    if (count == 1) {
+        out = *order[0];
+        return;
+    }
+    out.resize(order[0]->size());
+    out.resize(intersect(order[0]->data(), order[0]->size(),
+                         order[1]->data(), order[1]->size(),
+                         out.data()));
+    for (size_t i = 2; i < count && !out.empty(); ++i)
+        out.resize(intersect(out.data(), out.size(),
+                             order[i]->data(), order[i]->size(),
+                             out.data()));
+}
+
+
+
+/** ***************************************************************************/
+size_t Intersection::merge(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j])
+            ++i;
+        else if (b[j] < a[i])
+            ++j;
+        else {
+            out[k++] = a[i];
+            ++i;
+            ++j;
+        }
+    }
+    return k;
+}
+
+
+
+/** ***************************************************************************/
+size_t Intersection::gallop(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t k = 0;
+    const uint32_t *lo = b;
+    const uint32_t *end = b + nb;
+    for (size_t i = 0; i < na && lo != end; ++i) {
+        const uint32_t value = a[i];
+
+        // Exponentially widen the window until it contains the value...
+        size_t step = 1;
+        const uint32_t *hi = lo;
+        while (hi < end && *hi < value) {
+            lo = hi;
+            hi = (static_cast<size_t>(end - hi) > step) ? hi + step : end;
+            step <<= 1;
+        }
+
+        // ...and binary search the window
+        lo = std::lower_bound(lo, hi == end ? end : hi + 1, value);
+        if (lo != end && *lo == value) {
+            out[k++] = value;
+            ++lo;
+        }
+    }
+    return k;
+}
+
+
+
+/** ***************************************************************************/
+size_t Intersection::simd(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t i = 0, j = 0, k = 0;
+#ifdef __SSE2__
+    /*
+     * Block merge: compare four elements of a against all rotations of four
+     * elements of b, i.e. all 16 pairs, in four vector comparisons. Then
+     * advance the block with the smaller maximum (or both).
+     */
+    const size_t na4 = na & ~static_cast<size_t>(3);
+    const size_t nb4 = nb & ~static_cast<size_t>(3);
+    while (i < na4 && j < nb4) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i cmp = _mm_cmpeq_epi32(va, vb);
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0,3,2,1))));
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1,0,3,2))));
+        cmp = _mm_or_si128(cmp, _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2,1,0,3))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(cmp));
+
+        // Emit the matching elements of a in order
+        for (size_t l = 0; mask != 0; ++l, mask >>= 1)
+            if (mask & 1)
+                out[k++] = a[i + l];
+
+        const uint32_t maxA = a[i + 3];
+        const uint32_t maxB = b[j + 3];
+        if (maxA <= maxB)
+            i += 4;
+        if (maxB <= maxA)
+            j += 4;
+    }
+#endif
+    // Merge the remainders
+    return k + merge(a + i, na - i, b + j, nb - j, out + k);
+}
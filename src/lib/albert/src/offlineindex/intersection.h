@@ -0,0 +1,55 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The Intersection class
+ * Intersects ascending, duplicate free posting lists. Depending on the ratio
+ * of the list lengths a linear merge, a galloping (exponential) search or a
+ * SIMD block merge is used. Nothing is allocated, the results are written to
+ * caller provided buffers.
+ */
+class Intersection final
+{
+public:
+
+    /**
+     * @brief Intersects two lists
+     * out may alias a, but it must not alias b.
+     * @return The number of ids written to out
+     */
+    static size_t intersect(const uint32_t *a, size_t na,
+                            const uint32_t *b, size_t nb,
+                            uint32_t *out);
+
+    /**
+     * @brief Intersects the first count lists, smallest first
+     * The lists are left untouched, the intersection is written to out.
+     */
+    static void intersect(const std::vector<std::vector<uint32_t>> &lists, size_t count,
+                          std::vector<uint32_t> &out);
+
+private:
+
+    static size_t merge(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+    static size_t gallop(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+    static size_t simd(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+
+};
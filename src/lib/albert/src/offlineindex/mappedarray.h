@@ -0,0 +1,57 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The MappedArray class
+ * A read only array that either owns its elements or refers to elements owned
+ * elsewhere, e.g. memory mapped from a file. Movable, not copyable.
+ */
+template<class T>
+class MappedArray final
+{
+public:
+
+    MappedArray() {}
+    MappedArray(std::vector<T> &&values)
+        : values_(std::move(values)), data_(values_.data()), size_(values_.size()) {}
+    MappedArray(const T *data, size_t size) : data_(data), size_(size) {}
+
+    // Moving a vector keeps its buffer, the pointer stays valid
+    MappedArray(MappedArray &&) = default;
+    MappedArray &operator=(MappedArray &&) = default;
+    MappedArray(const MappedArray &) = delete;
+    MappedArray &operator=(const MappedArray &) = delete;
+
+    const T &operator[](size_t i) const { return data_[i]; }
+    const T *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T &back() const { return data_[size_ - 1]; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+
+private:
+
+    std::vector<T> values_;
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+
+};
@@ -15,16 +15,62 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include "offlineindex.h"
 #include "indeximpl.h"
 #include "iindexable.h"
 #include "prefixsearch.hpp"
 #include "fuzzysearch.hpp"
 
+// The state a session keeps between its searches
+struct OfflineIndex::Session {
+    uint64_t id;
+    std::unique_ptr<SearchCache> cache;    // Null while a search of the session uses it
+    std::shared_ptr<const IndexImpl> more; // The snapshot of the last top k search, if any
+    QString moreRequest;
+    size_t moreOffset;
+};
+
+namespace {
+
+// The header of a saved index. The payload is the serialized term index.
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t items;
+    uint64_t payloadSize;
+    uint64_t checksum;
+};
+const char MAGIC[8] = {'A', 'L', 'B', 'E', 'R', 'T', 'I', 'X'};
+const uint32_t VERSION = 4;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// A fast checksum of 8 byte aligned data, eight bytes per step
+uint64_t checksum(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3;
+        hash ^= hash >> 29;
+    }
+    return hash ^ size;
+}
+
+}
+
 
 /** ***************************************************************************/
 OfflineIndex::OfflineIndex(bool fuzzy) {
     (fuzzy) ? impl_ = new FuzzySearch() : impl_ = new PrefixSearch();
+    publish();
 }
 
 
@@ -38,6 +84,7 @@ OfflineIndex::~OfflineIndex() {
 
 /** ***************************************************************************/
 void OfflineIndex::setFuzzy(bool fuzzy) {
+    QMutexLocker locker(&writeMutex_);
     if (dynamic_cast<FuzzySearch*>(impl_)) {
         if (fuzzy) return;
         FuzzySearch *old = dynamic_cast<FuzzySearch*>(impl_);
@@ -51,12 +98,14 @@ void OfflineIndex::setFuzzy(bool fuzzy) {
     } else {
         throw; //should not happen
     }
+    publish();
 }
 
 
 
 /** ***************************************************************************/
 bool OfflineIndex::fuzzy() {
+    QMutexLocker locker(&writeMutex_);
     return dynamic_cast<FuzzySearch*>(impl_) != nullptr;
 }
 
@@ -64,15 +113,19 @@ bool OfflineIndex::fuzzy() {
 
 /** ***************************************************************************/
 void OfflineIndex::setDelta(double d) {
+    QMutexLocker locker(&writeMutex_);
     FuzzySearch* f = dynamic_cast<FuzzySearch*>(impl_);
-    if (f)
+    if (f) {
         f->setDelta(d);
+        publish();
+    }
 }
 
 
 
 /** ***************************************************************************/
 double OfflineIndex::delta() {
+    QMutexLocker locker(&writeMutex_);
     FuzzySearch* f = dynamic_cast<FuzzySearch*>(impl_);
     if (f)
         return f->delta();
@@ -83,19 +136,257 @@ double OfflineIndex::delta() {
 
 /** ***************************************************************************/
 void OfflineIndex::add(std::shared_ptr<IIndexable> idxble) {
+    QMutexLocker locker(&writeMutex_);
+    impl_->add(idxble);
+    impl_->build();
+    publish();
+}
+
+
+
+/** ***************************************************************************/
+void OfflineIndex::remove(std::shared_ptr<IIndexable> idxble) {
+    QMutexLocker locker(&writeMutex_);
+    impl_->remove({idxble});
+    impl_->build();
+    publish();
+}
+
+
+
+/** ***************************************************************************/
+void OfflineIndex::update(std::shared_ptr<IIndexable> idxble) {
+    QMutexLocker locker(&writeMutex_);
+    impl_->remove({idxble});
     impl_->add(idxble);
+    impl_->build();
+    publish();
+}
+
+
+
+/** ***************************************************************************/
+void OfflineIndex::applyDelta(const std::vector<std::shared_ptr<IIndexable>> &added,
+                              const std::vector<std::shared_ptr<IIndexable>> &removed) {
+    QMutexLocker locker(&writeMutex_);
+    impl_->remove(removed);
+    for (const std::shared_ptr<IIndexable> &idxble : added)
+        impl_->add(idxble);
+    impl_->build();
+    publish();
 }
 
 
 
 /** ***************************************************************************/
 void OfflineIndex::clear() {
+    QMutexLocker locker(&writeMutex_);
     impl_->clear();
+    publish();
+}
+
+
+
+/** ***************************************************************************/
+bool OfflineIndex::save(const QString &path, const std::vector<std::shared_ptr<IIndexable>> &items) {
+    // Build the index of the items in their order
+    QByteArray payload;
+    {
+        QMutexLocker locker(&writeMutex_);
+        TermIndex(dynamic_cast<PrefixSearch*>(impl_)->postings(items)).serialize(payload);
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.items = items.size();
+    header.payloadSize = static_cast<uint64_t>(payload.size());
+    header.checksum = checksum(payload.constData(), static_cast<size_t>(payload.size()));
+
+    // Replace the file atomically, mappings of the old one stay valid
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+            || file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)
+            || file.write(payload) != payload.size()
+            || !file.commit()) {
+        qWarning() << "Could not write the index to" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+
+
+/** ***************************************************************************/
+bool OfflineIndex::load(const QString &path, const std::vector<std::shared_ptr<IIndexable>> &items) {
+    // Map the file, it is unmapped when the last index referring to it is gone
+    std::shared_ptr<QFile> file = std::make_shared<QFile>(path);
+    if (!file->open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = file->size();
+    const char *data = (size >= static_cast<qint64>(sizeof(FileHeader)))
+            ? reinterpret_cast<const char*>(file->map(0, size)) : nullptr;
+    if (!data) {
+        qWarning() << "Could not map the index" << path;
+        return false;
+    }
+
+    // Check the header and the payload, do not trust anything else
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const char *payload = data + sizeof(header);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION
+            || header.byteOrder != BYTE_ORDER_MARK
+            || header.items != items.size()
+            || header.payloadSize != static_cast<uint64_t>(size) - sizeof(header)
+            || header.checksum != checksum(payload, static_cast<size_t>(header.payloadSize))) {
+        qWarning() << "Discarding the outdated or corrupt index" << path;
+        return false;
+    }
+    std::shared_ptr<const TermIndex> index = TermIndex::map(payload, static_cast<size_t>(header.payloadSize), file);
+    if (!index) {
+        qWarning() << "Discarding the malformed index" << path;
+        return false;
+    }
+
+    QMutexLocker locker(&writeMutex_);
+    dynamic_cast<PrefixSearch*>(impl_)->assign(items, index);
+    publish();
+    return true;
+}
+
+
+
+/** ***************************************************************************/
+OfflineIndex::FuzzyStats OfflineIndex::fuzzyStats() const {
+    std::shared_ptr<const IndexImpl> snapshot = std::atomic_load(&snapshot_);
+    const FuzzySearch* f = dynamic_cast<const FuzzySearch*>(snapshot.get());
+    if (f)
+        return f->stats();
+    return FuzzyStats();
+}
+
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<IIndexable>, short>> OfflineIndex::search(const QString &req,
+                                                                                const CancellationToken *token,
+                                                                                uint64_t session) const {
+    // Hold a reference, the snapshot stays valid even if a newer one is published
+    std::shared_ptr<const IndexImpl> snapshot = std::atomic_load(&snapshot_);
+    return cachedSearch(snapshot, req, IndexImpl::ALL, token, session);
+}
+
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<IIndexable>, short>> OfflineIndex::search(const QString &req, size_t k,
+                                                                                const CancellationToken *token,
+                                                                                uint64_t session) const {
+    std::shared_ptr<const IndexImpl> snapshot = std::atomic_load(&snapshot_);
+    return cachedSearch(snapshot, req, k, token, session);
+}
+
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<IIndexable>, short>>
+OfflineIndex::cachedSearch(const std::shared_ptr<const IndexImpl> &snapshot, const QString &req, size_t k,
+                           const CancellationToken *token, uint64_t session) const {
+    if (session == 0)
+        return snapshot->search(req, k, nullptr, token);
+
+    // Take the cache of the session, concurrent searches of it do without
+    std::unique_ptr<SearchCache> cache;
+    {
+        QMutexLocker locker(&sessionMutex_);
+        std::swap(cache, findSession(session, true)->cache);
+    }
+    if (!cache)
+        cache.reset(new SearchCache);
+
+    // The candidates are valid for the snapshot they were found in only
+    if (cache->index != snapshot) {
+        cache->index = snapshot;
+        cache->words.clear();
+    }
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>> results = snapshot->search(req, k, cache.get(), token);
+
+    // Put it back, unless another search of the session did meanwhile.
+    // Remember the top k search for a continuation, unless it was stopped.
+    {
+        QMutexLocker locker(&sessionMutex_);
+        Session *state = findSession(session, true);
+        if (!state->cache)
+            state->cache = std::move(cache);
+        if (token && token->stopRequested())
+            state->more.reset();
+        else if (k != IndexImpl::ALL) {
+            state->more = snapshot;
+            state->moreRequest = req;
+            state->moreOffset = results.size();
+        }
+    }
+    return results;
+}
+
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<IIndexable>, short>> OfflineIndex::searchMore(const QString &req, size_t k,
+                                                                                    uint64_t session) const {
+    std::shared_ptr<const IndexImpl> snapshot;
+    size_t offset = 0;
+    {
+        QMutexLocker locker(&sessionMutex_);
+        const Session *state = (session == 0) ? nullptr : findSession(session, false);
+        if (!state || !state->more || state->moreRequest != req || k == 0)
+            return std::vector<std::pair<std::shared_ptr<IIndexable>, short>>();
+        snapshot = state->more;
+        offset = state->moreOffset;
+    }
+
+    // The order is deterministic, rerun for offset+k and skip the known ones
+    k = std::min(k, IndexImpl::ALL - 1 - offset);
+    std::vector<std::pair<std::shared_ptr<IIndexable>, short>> results = snapshot->search(req, offset + k, nullptr, nullptr);
+    if (results.size() <= offset)
+        return std::vector<std::pair<std::shared_ptr<IIndexable>, short>>();
+    results.erase(results.begin(), results.begin() + static_cast<std::ptrdiff_t>(offset));
+
+    // Advance, unless the session searched meanwhile
+    QMutexLocker locker(&sessionMutex_);
+    Session *state = findSession(session, false);
+    if (state && state->more == snapshot && state->moreRequest == req && state->moreOffset == offset)
+        state->moreOffset += results.size();
+    return results;
+}
+
+
+
+/** ***************************************************************************/
+OfflineIndex::Session *OfflineIndex::findSession(uint64_t id, bool create) const {
+    // Called locked. Moves the session to the front, evicts the least
+    // recently used ones if it is new.
+    std::vector<std::unique_ptr<Session>>::iterator it = std::find_if(sessions_.begin(), sessions_.end(),
+        [id](const std::unique_ptr<Session> &session){ return session->id == id; });
+    if (it != sessions_.end()) {
+        std::rotate(sessions_.begin(), it, it + 1);
+        return sessions_.front().get();
+    }
+    if (!create)
+        return nullptr;
+    sessions_.emplace(sessions_.begin(), new Session{id, nullptr, nullptr, QString(), 0});
+    if (sessions_.size() > MAX_SESSIONS)
+        sessions_.resize(MAX_SESSIONS);
+    return sessions_.front().get();
 }
 
 
 
 /** ***************************************************************************/
-std::vector<std::shared_ptr<IIndexable> > OfflineIndex::search(const QString &req) const {
-    return impl_->search(req);
+void OfflineIndex::publish() {
+    // The snapshot shares the immutable parts of the index, this is cheap
+    std::atomic_store(&snapshot_, impl_->snapshot());
 }
@@ -0,0 +1,127 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include "prefixeditdistance.h"
+
+
+
+/** ***************************************************************************/
+PrefixEditDistance::PrefixEditDistance(const QString &prefix)
+    : length_(static_cast<unsigned int>(prefix.size())),
+      blocks_((length_ + 63) / 64),
+      latin1Masks_(256 * blocks_, 0),
+      noMatch_(blocks_, 0) {
+
+    // Collect the distinct non Latin-1 characters
+    for (int i = 0; i < prefix.size(); ++i)
+        if (prefix[i].unicode() > 0xFF)
+            otherChars_.push_back(prefix[i].unicode());
+    std::sort(otherChars_.begin(), otherChars_.end());
+    otherChars_.erase(std::unique(otherChars_.begin(), otherChars_.end()), otherChars_.end());
+    otherMasks_.assign(otherChars_.size() * blocks_, 0);
+
+    // Set bit i in the mask of the character at position i
+    for (unsigned int i = 0; i < length_; ++i) {
+        const ushort c = prefix[static_cast<int>(i)].unicode();
+        uint64_t *masks = (c <= 0xFF)
+                ? &latin1Masks_[c * blocks_]
+                : &otherMasks_[static_cast<size_t>(std::lower_bound(otherChars_.begin(), otherChars_.end(), c)
+                                                   - otherChars_.begin()) * blocks_];
+        masks[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+
+
+/** ***************************************************************************/
+unsigned int PrefixEditDistance::distance(const QChar *str, int size, unsigned int delta) const {
+    // D[m][0] = m
+    unsigned int score = length_;
+    unsigned int best = std::min(score, delta + 1);
+    if (best == 0)
+        return 0;
+
+    // Beyond column m+delta the distance is greater than delta anyway
+    const unsigned int columns = std::min(static_cast<unsigned int>(size), length_ + delta);
+    const uint64_t high = uint64_t(1) << ((length_ - 1) % 64);
+
+    // Common case: the prefix fits into a single word
+    if (blocks_ == 1) {
+        uint64_t pv = ~uint64_t(0), mv = 0;
+        for (unsigned int j = 0; j < columns; ++j) {
+            score += advance(pv, mv, *peq(str[j]), 1, high);
+            best = std::min(best, score);
+            // The score decreases by at most one per column
+            if (best == 0 || score >= best + (columns - j - 1))
+                return best;
+        }
+        return best;
+    }
+
+    // Long prefixes: propagate the horizontal deltas through the blocks
+    static thread_local std::vector<uint64_t> pv, mv;
+    pv.assign(blocks_, ~uint64_t(0));
+    mv.assign(blocks_, 0);
+    for (unsigned int j = 0; j < columns; ++j) {
+        const uint64_t *eq = peq(str[j]);
+        int h = 1;
+        for (size_t b = 0; b + 1 < blocks_; ++b)
+            h = advance(pv[b], mv[b], eq[b], h, uint64_t(1) << 63);
+        score += advance(pv[blocks_ - 1], mv[blocks_ - 1], eq[blocks_ - 1], h, high);
+        best = std::min(best, score);
+        if (best == 0 || score >= best + (columns - j - 1))
+            return best;
+    }
+    return best;
+}
+
+
+
+/** ***************************************************************************/
+const uint64_t *PrefixEditDistance::peq(QChar c) const {
+    if (c.unicode() <= 0xFF)
+        return &latin1Masks_[c.unicode() * blocks_];
+    std::vector<ushort>::const_iterator it = std::lower_bound(otherChars_.begin(), otherChars_.end(), c.unicode());
+    if (it == otherChars_.end() || *it != c.unicode())
+        return noMatch_.data();
+    return &otherMasks_[static_cast<size_t>(it - otherChars_.begin()) * blocks_];
+}
+
+
+
+/** ***************************************************************************/
+int PrefixEditDistance::advance(uint64_t &pv, uint64_t &mv, uint64_t eq, int hin, uint64_t high) {
+    // Computes one column of a block of the DP matrix, encoded as vertical
+    // deltas. hin is the horizontal delta entering the block from above, the
+    // return value the one leaving it at the bottom.
+    const uint64_t xv = eq | mv;
+    if (hin < 0)
+        eq |= 1;
+    const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    const int hout = (ph & high) ? 1 : (mh & high) ? -1 : 0;
+    ph <<= 1;
+    mh <<= 1;
+    if (hin < 0)
+        mh |= 1;
+    else if (hin > 0)
+        ph |= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+    return hout;
+}
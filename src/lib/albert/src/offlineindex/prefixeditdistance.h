@@ -0,0 +1,60 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QString>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The PrefixEditDistance class
+ * Computes the prefix edit distance of a fixed prefix to arbitrary strings,
+ * i.e. the minimal edit distance of the prefix to any prefix of the string.
+ * Uses the bit-parallel algorithm of Myers in the block based formulation of
+ * Hyyrö, one 64 bit word per 64 characters of the prefix. The bitmasks of the
+ * prefix are built once, the checks do not allocate.
+ */
+class PrefixEditDistance final
+{
+public:
+
+    explicit PrefixEditDistance(const QString &prefix);
+
+    /** Returns true if the prefix edit distance to str is at most delta */
+    bool check(const QString &str, unsigned int delta) const {
+        return distance(str.constData(), str.size(), delta) <= delta;
+    }
+
+    /** Returns the prefix edit distance to str if it is at most delta, else delta+1 */
+    unsigned int distance(const QChar *str, int size, unsigned int delta) const;
+
+private:
+
+    const uint64_t *peq(QChar c) const;
+
+    static int advance(uint64_t &pv, uint64_t &mv, uint64_t eq, int hin, uint64_t high);
+
+    unsigned int length_;
+    size_t blocks_;
+
+    // The match masks of the prefix, blocks_ words per character. Latin-1
+    // characters are looked up directly, others by binary search.
+    std::vector<uint64_t> latin1Masks_;
+    std::vector<ushort> otherChars_;
+    std::vector<uint64_t> otherMasks_;
+    std::vector<uint64_t> noMatch_;
+
+};
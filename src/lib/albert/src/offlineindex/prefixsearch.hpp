@@ -15,31 +15,49 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
-#include <QRegularExpression>
 #include <algorithm>
+#include <climits>
+#include <functional>
 #include <vector>
-#include <set>
 #include <map>
 #include <memory>
+#include <unordered_map>
 #include "indeximpl.h"
 #include "iindexable.h"
+#include "intersection.h"
+#include "termindex.h"
+#include "tokenizer.h"
 using std::vector;
-using std::set;
 using std::map;
 using std::shared_ptr;
 using std::unique_ptr;
 
 class PrefixSearch : public IndexImpl
 {
+    // A scored item id. Ordered best first, ties by id.
+    struct Hit {
+        uint32_t score;
+        uint32_t id;
+        bool operator<(const Hit &rhs) const {
+            return score > rhs.score || (score == rhs.score && id < rhs.id);
+        }
+    };
+
 public:
     /** ***********************************************************************/
-    PrefixSearch(){}
+    PrefixSearch()
+        : baseItems_(std::make_shared<const vector<shared_ptr<IIndexable>>>()),
+          base_(std::make_shared<const TermIndex>()),
+          deltaIndex_(std::make_shared<const TermIndex>()) {}
 
 
 
     /** ***********************************************************************/
     PrefixSearch(const PrefixSearch &rhs) {
-        invertedIndex_ = rhs.invertedIndex_;
+        assignSearchState(rhs);
+        pending_ = rhs.pending_;
+        pendingCount_ = rhs.pendingCount_;
+        ids_ = rhs.ids_;
     }
 
 
@@ -51,77 +69,658 @@ public:
 
     /** ***********************************************************************/
     void add(shared_ptr<IIndexable> idxble) override {
+        uint32_t id = addItem(idxble);
+        static thread_local QString folded;
+        static thread_local vector<Tokenizer::Token> tokens;
         vector<IIndexable::WeightedKeyword> indexKeywords = idxble->indexKeywords();
         for (const auto &wkw : indexKeywords) {
             // Build an inverted index
-            QStringList words = wkw.keyword.split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts);
-            for (const QString &w : words) {
-                invertedIndex_[w.toLower()].insert(idxble);
+            Tokenizer::tokenize(wkw.keyword, folded, tokens);
+            for (const Tokenizer::Token &token : tokens)
+                addPosting(QString(folded.constData() + token.offset, token.size), id, wkw.relevance);
+        }
+    }
+
+
+
+    /** ***********************************************************************/
+    void remove(const vector<shared_ptr<IIndexable>> &idxbles) override {
+        if (idxbles.empty())
+            return;
+
+        // Tombstone the items. Their postings are dropped on compaction.
+        for (const shared_ptr<IIndexable> &idxble : idxbles) {
+            std::unordered_map<const IIndexable*, uint32_t>::iterator it = ids_.find(idxble.get());
+            if (it == ids_.end())
+                continue;
+            const uint32_t id = it->second;
+            ids_.erase(it);
+            if (!isRemoved(id)) {
+                removed_[id / 64] |= uint64_t(1) << (id % 64);
+                ++removedCount_;
             }
         }
     }
 
 
 
+    /** ***********************************************************************/
+    void build() override {
+        // Merge delta and base if the delta got too large to be searched
+        // efficiently or if there are too many removed items
+        uint64_t live = size() - removedCount_;
+        if (pendingCount_ > MIN_COMPACTION + base_->postingCount() / 8
+                || removedCount_ > MIN_COMPACTION + live / 4)
+            compact();
+        else if (pendingCount_ != deltaIndex_->postingCount())
+            deltaIndex_ = std::make_shared<const TermIndex>(pending_);
+    }
+
+
+
     /** ***********************************************************************/
     void clear() override {
-        invertedIndex_.clear();
+        baseItems_ = std::make_shared<const vector<shared_ptr<IIndexable>>>();
+        base_ = std::make_shared<const TermIndex>();
+        deltaItems_.clear();
+        deltaIndex_ = std::make_shared<const TermIndex>();
+        removed_.clear();
+        removedCount_ = 0;
+        pending_.clear();
+        pendingCount_ = 0;
+        ids_.clear();
     }
 
 
 
     /** ***********************************************************************/
-    vector<shared_ptr<IIndexable>> search(const QString &req) const override {
+    shared_ptr<const IndexImpl> snapshot() const override {
+        shared_ptr<PrefixSearch> snapshot = std::make_shared<PrefixSearch>();
+        snapshot->assignSearchState(*this);
+        return snapshot;
+    }
 
 
-        // Split the query into words W
-        QStringList words = req.split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts);
 
-        // Skip if there arent any // CONSTRAINT (2): |W| > 0
-        if (words.empty())
-            return vector<shared_ptr<IIndexable>>();
+    /** ***********************************************************************/
+    TermIndex::Postings postings(const vector<shared_ptr<IIndexable>> &items) const {
+        // The ids of the items are their positions in items, the items not
+        // in there are dropped
+        std::unordered_map<const IIndexable*, uint32_t> positions;
+        for (size_t i = 0; i < items.size(); ++i)
+            positions.emplace(items[i].get(), static_cast<uint32_t>(i));
+        vector<uint32_t> ids(size(), REMOVED);
+        for (uint32_t id = 0; id < size(); ++id) {
+            std::unordered_map<const IIndexable*, uint32_t>::const_iterator it = positions.find(item(id).get());
+            if (!isRemoved(id) && it != positions.end())
+                ids[id] = it->second;
+        }
+        return mergedPostings(ids);
+    }
 
-        set<shared_ptr<IIndexable>> resultsSet;
-        QStringList::iterator wordIterator = words.begin();
 
-        // Make lower for case insensitivity
-        QString word = wordIterator++->toLower();
 
-        // Get a word mapping once before goint to handle intersections
-        for (InvertedIndex::const_iterator lb = invertedIndex_.lower_bound(word);
-             lb != invertedIndex_.cend() && lb->first.startsWith(word); ++lb)
-            resultsSet.insert(lb->second.begin(), lb->second.end());
+    /** ***********************************************************************/
+    virtual void assign(const vector<shared_ptr<IIndexable>> &items, shared_ptr<const TermIndex> index) {
+        // Replace the whole index, the ids of the index refer to items
+        baseItems_ = std::make_shared<const vector<shared_ptr<IIndexable>>>(items);
+        base_ = index;
+        deltaItems_.clear();
+        deltaIndex_ = std::make_shared<const TermIndex>();
+        removed_.assign((size() + 63) / 64, 0);
+        removedCount_ = 0;
+        pending_.clear();
+        pendingCount_ = 0;
+        indexItems();
+    }
 
 
-        for (;wordIterator != words.end(); ++wordIterator) {
 
-            // Make lower for case insensitivity
-            word = wordIterator->toLower();
+    /** ***********************************************************************/
+    vector<std::pair<shared_ptr<IIndexable>, short>> search(const QString &req, size_t k,
+                                                            SearchCache *cache,
+                                                            const CancellationToken *token) const override {
 
-            // Unite the sets that are mapped by words that begin with word
-            // w ∈ W. This set is called U_w
-            set<shared_ptr<IIndexable>> wordMappingsUnion;
-            for (InvertedIndex::const_iterator lb = invertedIndex_.lower_bound(word);
-                 lb != invertedIndex_.cend() && lb->first.startsWith(word); ++lb)
-                wordMappingsUnion.insert(lb->second.begin(), lb->second.end());
+        // Split the query into words W, folded like the indexed words
+        vector<QString> words = Tokenizer::words(req);
 
+        // Skip if there arent any // CONSTRAINT (2): |W| > 0
+        if (words.empty() || k == 0) {
+            if (cache)
+                cache->words.clear();
+            return vector<std::pair<shared_ptr<IIndexable>, short>>();
+        }
+
+        // The candidates are kept in the cache of the session if there is one
+        static thread_local SearchCache scratch;
+        SearchCache &candidates = (cache) ? *cache : scratch;
+
+        // Filter the last candidates if the query extends the last one, else
+        // rank a single word without uniting all postings or search all words.
+        // Sessions unite small prefixes, the next keystroke filters them.
+        if (!(cache && filterCandidates(words, candidates, token))) {
+            if (words.size() == 1 && k < size()
+                    && !(cache && postingBytes(words.front()) <= MAX_CACHED_UNION))
+                return searchBest(words.front(), k, cache, token);
+            searchCandidates(words, candidates, token);
+        }
+
+        // The candidates of a stopped search are incomplete, drop them
+        if (stopRequested(token)) {
+            candidates.words.clear();
+            return vector<std::pair<shared_ptr<IIndexable>, short>>();
+        }
 
-            // Intersect all sets U_w with the results
-            set<shared_ptr<IIndexable>> intersection;
-            std::set_intersection(resultsSet.begin(), resultsSet.end(),
-                                  wordMappingsUnion.begin(), wordMappingsUnion.end(),
-                                  std::inserter(intersection, intersection.begin()));
-            resultsSet = std::move(intersection);
+        // Select the hits
+        static thread_local vector<Hit> hits;
+        hits.clear();
+        const bool cut = k < candidates.ids.size();
+        for (size_t i = 0; i < candidates.ids.size(); ++i) {
+            const Hit hit{candidates.headScores[i] + candidates.lastScores[i], candidates.ids[i]};
+            if (cut)
+                pushHit(hits, hit, k);
+            else
+                hits.push_back(hit);
         }
 
-        // Convert to a std::vector
-        vector<shared_ptr<IIndexable>> resultsVector(resultsSet.begin(), resultsSet.end());
+        // Resolve the item ids
+        if (cut)
+            std::sort_heap(hits.begin(), hits.end());
+        else if (k != ALL)
+            std::sort(hits.begin(), hits.end());
+        vector<std::pair<shared_ptr<IIndexable>, short>> resultsVector;
+        resultsVector.reserve(hits.size());
+        for (const Hit &hit : hits)
+            resultsVector.emplace_back(item(hit.id), matchScore(hit.score, words.size()));
         return resultsVector;
     }
 
 protected:
-    typedef map<QString, set<shared_ptr<IIndexable>>> InvertedIndex;
-    InvertedIndex invertedIndex_;
+
+    /** ***********************************************************************/
+    void assignSearchState(const PrefixSearch &rhs) {
+        // The large parts are immutable and shared
+        baseItems_ = rhs.baseItems_;
+        base_ = rhs.base_;
+        deltaItems_ = rhs.deltaItems_;
+        deltaIndex_ = rhs.deltaIndex_;
+        removed_ = rhs.removed_;
+        removedCount_ = rhs.removedCount_;
+    }
+
+
+
+    /** ***********************************************************************/
+    uint32_t size() const {
+        return static_cast<uint32_t>(baseItems_->size() + deltaItems_.size());
+    }
+
+
+
+    /** ***********************************************************************/
+    const shared_ptr<IIndexable> &item(uint32_t id) const {
+        return (id < baseItems_->size()) ? (*baseItems_)[id] : deltaItems_[id - baseItems_->size()];
+    }
+
+
+
+    /** ***********************************************************************/
+    bool isRemoved(uint32_t id) const {
+        return (removed_[id / 64] >> (id % 64)) & 1;
+    }
+
+
+
+    /** ***********************************************************************/
+    uint32_t addItem(const shared_ptr<IIndexable> &idxble) {
+        deltaItems_.push_back(idxble);
+        if (removed_.size() * 64 < size())
+            removed_.push_back(0);
+        ids_[idxble.get()] = size() - 1;
+        return size() - 1;
+    }
+
+
+
+    /** ***********************************************************************/
+    void addPosting(const QString &term, uint32_t id, uint32_t relevance) {
+        // Ids are assigned ascending, a duplicate can only be the last one.
+        // If an item contains a term twice the more relevant keyword counts.
+        const uint16_t clamped = static_cast<uint16_t>(std::min<uint32_t>(relevance, USHRT_MAX));
+        vector<TermIndex::Posting> &postings = pending_[term];
+        if (postings.empty() || postings.back().id != id) {
+            postings.push_back(TermIndex::Posting{id, clamped});
+            ++pendingCount_;
+        } else
+            postings.back().relevance = std::max(postings.back().relevance, clamped);
+    }
+
+
+
+    /** ***********************************************************************/
+    void compact() {
+        // Assign new dense ids to the remaining items
+        vector<uint32_t> ids(size(), REMOVED);
+        shared_ptr<vector<shared_ptr<IIndexable>>> items = std::make_shared<vector<shared_ptr<IIndexable>>>();
+        items->reserve(size() - removedCount_);
+        for (uint32_t id = 0; id < size(); ++id)
+            if (!isRemoved(id)) {
+                ids[id] = static_cast<uint32_t>(items->size());
+                items->push_back(item(id));
+            }
+        TermIndex::Postings postings = mergedPostings(ids);
+
+        // Replace (not modify) the shared parts, snapshots may still use them
+        baseItems_ = items;
+        base_ = std::make_shared<const TermIndex>(postings);
+        deltaItems_.clear();
+        deltaIndex_ = std::make_shared<const TermIndex>();
+        removed_.assign((size() + 63) / 64, 0);
+        removedCount_ = 0;
+        pending_.clear();
+        pendingCount_ = 0;
+        indexItems();
+    }
+
+
+
+    /** ***********************************************************************/
+    void indexItems() {
+        // Map the items to their new ids, the compaction is linear anyway
+        ids_.clear();
+        ids_.reserve(size());
+        for (uint32_t id = 0; id < size(); ++id)
+            ids_[item(id).get()] = id;
+    }
+
+
+
+    /** ***********************************************************************/
+    TermIndex::Postings mergedPostings(const vector<uint32_t> &ids) const {
+        // Merge the delta into the base, the delta ids are all greater
+        TermIndex::Postings postings = base_->toPostings();
+        for (auto &entry : pending_) {
+            vector<TermIndex::Posting> &termPostings = postings[entry.first];
+            termPostings.insert(termPostings.end(), entry.second.begin(), entry.second.end());
+        }
+
+        // Translate the ids, drop the postings of removed items. Keep the
+        // postings sorted, unless the mapping is monotonic they are not.
+        for (auto it = postings.begin(); it != postings.end();) {
+            vector<TermIndex::Posting> &termPostings = it->second;
+            size_t k = 0;
+            for (const TermIndex::Posting &posting : termPostings)
+                if (ids[posting.id] != REMOVED)
+                    termPostings[k++] = TermIndex::Posting{ids[posting.id], posting.relevance};
+            termPostings.resize(k);
+            if (!std::is_sorted(termPostings.begin(), termPostings.end(), postingLess))
+                std::sort(termPostings.begin(), termPostings.end(), postingLess);
+            if (termPostings.empty())
+                it = postings.erase(it);
+            else
+                ++it;
+        }
+        return postings;
+    }
+
+
+
+    /** ***********************************************************************/
+    static bool postingLess(const TermIndex::Posting &l, const TermIndex::Posting &r) {
+        return l.id < r.id;
+    }
+
+
+
+    /** ***********************************************************************/
+    void searchCandidates(const vector<QString> &words, SearchCache &candidates,
+                          const CancellationToken *token) const {
+        candidates.words = words;
+        candidates.ids.clear();
+        candidates.headScores.clear();
+        candidates.lastScores.clear();
+
+        // Per thread scratch buffers, reused to avoid allocations per keystroke
+        static thread_local vector<vector<uint32_t>> wordMappings;
+        static thread_local vector<vector<uint16_t>> wordScores;
+        static thread_local vector<uint32_t> intersection;
+        if (wordMappings.size() < words.size()) {
+            wordMappings.resize(words.size());
+            wordScores.resize(words.size());
+        }
+
+        // Unite the sets that are mapped by words that begin with word w ∈ W.
+        // This set is called U_w.
+        const size_t count = words.size();
+        for (size_t w = 0; w < count; ++w) {
+            wordMappings[w].clear();
+            wordScores[w].clear();
+            prefixUnion(words[w], wordMappings[w], wordScores[w], token);
+            if (wordMappings[w].empty() || stopRequested(token))
+                return;
+        }
+
+        // Intersect all sets U_w
+        const vector<uint32_t> *results = &wordMappings[0];
+        if (count > 1) {
+            Intersection::intersect(wordMappings, count, intersection);
+            results = &intersection;
+        }
+
+        // Accumulate the scores of the words, skipping removed items. The
+        // results are a sorted subset of every U_w.
+        static thread_local vector<size_t> positions;
+        positions.assign(count, 0);
+        for (uint32_t id : *results) {
+            uint32_t score = 0;
+            for (size_t w = 0; w < count; ++w) {
+                const vector<uint32_t> &ids = wordMappings[w];
+                size_t &position = positions[w];
+                while (ids[position] != id)
+                    ++position;
+                if (w + 1 < count)
+                    score += wordScores[w][position];
+            }
+            if (isRemoved(id))
+                continue;
+            candidates.ids.push_back(id);
+            candidates.headScores.push_back(score);
+            candidates.lastScores.push_back(wordScores[count - 1][positions[count - 1]]);
+        }
+    }
+
+
+
+    /** ***********************************************************************/
+    bool filterCandidates(const vector<QString> &words, SearchCache &candidates,
+                          const CancellationToken *token) const {
+        // The matches of the query are a subset of the candidates if it
+        // extends the last word or appends a word to the last query
+        const vector<QString> &last = candidates.words;
+        if (last.empty() || (words.size() != last.size() && words.size() != last.size() + 1))
+            return false;
+        const bool appended = words.size() != last.size();
+        const size_t head = last.size() - ((appended) ? 0 : 1);
+        if (!std::equal(last.begin(), last.begin() + static_cast<std::ptrdiff_t>(head), words.begin())
+                || (!appended && !words.back().startsWith(last.back())))
+            return false;
+
+        // Filtering costs a few term comparisons per candidate, a new search
+        // decodes the postings of all words. Take the cheaper one.
+        uint64_t bytes = 0;
+        for (const QString &word : words)
+            bytes += postingBytes(word);
+        if (candidates.ids.size() * FILTER_COST > bytes)
+            return false;
+
+        // Score the last word by the terms of the candidates, drop the ones
+        // not containing it
+        const QString &word = words.back();
+        static thread_local vector<TermIndex::ItemTerm> terms;
+        size_t n = 0;
+        for (size_t i = 0; i < candidates.ids.size(); ++i) {
+            // Poll the token every few candidates, the caller drops the rest
+            if (i % STOP_POLL_INTERVAL == 0 && stopRequested(token))
+                break;
+            const uint32_t id = candidates.ids[i];
+            const TermIndex &index = (id < baseItems_->size()) ? *base_ : *deltaIndex_;
+            terms.clear();
+            index.itemTerms(id, terms);
+            uint32_t best = 0;
+            for (const TermIndex::ItemTerm &term : terms)
+                if (index.startsWith(term.term, word)) {
+                    const double factor = matchFactor(word.size(), index.termSize(term.term), 0);
+                    best = std::max(best, static_cast<uint32_t>(term.relevance * factor) + 1);
+                }
+            if (best == 0)
+                continue;
+            candidates.ids[n] = id;
+            candidates.headScores[n] = candidates.headScores[i] + ((appended) ? candidates.lastScores[i] : 0);
+            candidates.lastScores[n] = static_cast<uint16_t>(best - 1);
+            ++n;
+        }
+        candidates.ids.resize(n);
+        candidates.headScores.resize(n);
+        candidates.lastScores.resize(n);
+        candidates.words = words;
+        return true;
+    }
+
+
+
+    /** ***********************************************************************/
+    uint64_t postingBytes(const QString &prefix) const {
+        // The size of the encoded postings of the terms starting with prefix
+        uint64_t bytes = 0;
+        for (const TermIndex *index : {base_.get(), deltaIndex_.get()}) {
+            std::pair<uint32_t, uint32_t> range = index->prefixRange(prefix);
+            bytes += index->postingBytes(range.first, range.second);
+        }
+        return bytes;
+    }
+
+
+
+    /** ***********************************************************************/
+    vector<std::pair<shared_ptr<IIndexable>, short>> searchBest(const QString &prefix, size_t k,
+                                                                SearchCache *cache,
+                                                                const CancellationToken *token) const {
+        // The best score a term can yield is known without decoding its
+        // postings. Scan the terms by descending bound and stop as soon as k
+        // items score higher than the bound of the next term. The matches of
+        // a scan that did not stop early are complete, they fill the cache.
+        struct Bound {
+            uint32_t bound;
+            uint32_t term;
+            const TermIndex *index;
+            bool operator<(const Bound &rhs) const { return bound > rhs.bound; }
+        };
+        static thread_local vector<Bound> bounds;
+        bounds.clear();
+        for (const TermIndex *index : {base_.get(), deltaIndex_.get()}) {
+            std::pair<uint32_t, uint32_t> range = index->prefixRange(prefix);
+            for (uint32_t t = range.first; t != range.second; ++t) {
+                const double factor = matchFactor(prefix.size(), index->termSize(t), 0);
+                bounds.push_back(Bound{static_cast<uint32_t>(index->maxRelevance(t) * factor), t, index});
+            }
+        }
+        std::sort(bounds.begin(), bounds.end());
+
+        // Collect the best score+1 per item, zero means untouched
+        vector<uint32_t> &best = denseScores();
+        static thread_local vector<TermIndex::Posting> postings;
+        static thread_local vector<uint32_t> touched;
+        static thread_local vector<uint32_t> kth;
+        touched.clear();
+        size_t decoded = 0, nextCheck = k;
+        bool complete = true;
+        for (const Bound &bound : bounds) {
+            if (stopRequested(token)) {
+                complete = false;
+                break;
+            }
+
+            // Check the stop condition, amortized over the decoded postings
+            if (touched.size() >= k && decoded >= nextCheck) {
+                kth.clear();
+                for (uint32_t id : touched)
+                    kth.push_back(best[id] - 1);
+                std::nth_element(kth.begin(), kth.begin() + static_cast<std::ptrdiff_t>(k - 1), kth.end(), std::greater<uint32_t>());
+                if (kth[k - 1] > bound.bound) {
+                    complete = false;
+                    break;
+                }
+                nextCheck = decoded + touched.size();
+            }
+
+            const double factor = matchFactor(prefix.size(), bound.index->termSize(bound.term), 0);
+            postings.clear();
+            bound.index->postings(bound.term, postings);
+            decoded += postings.size();
+            for (const TermIndex::Posting &posting : postings) {
+                if (isRemoved(posting.id))
+                    continue;
+                const uint32_t score = static_cast<uint32_t>(posting.relevance * factor) + 1;
+                if (best[posting.id] == 0)
+                    touched.push_back(posting.id);
+                if (best[posting.id] < score)
+                    best[posting.id] = score;
+            }
+        }
+
+        // Keep the complete matches for the next keystroke
+        if (cache) {
+            cache->words.clear();
+            if (complete) {
+                std::sort(touched.begin(), touched.end());
+                cache->ids.assign(touched.begin(), touched.end());
+                cache->headScores.assign(touched.size(), 0);
+                cache->lastScores.clear();
+                for (uint32_t id : touched)
+                    cache->lastScores.push_back(static_cast<uint16_t>(best[id] - 1));
+                cache->words.push_back(prefix);
+            }
+        }
+
+        // Select the best k and reset the dense array
+        static thread_local vector<Hit> hits;
+        hits.clear();
+        for (uint32_t id : touched) {
+            pushHit(hits, Hit{best[id] - 1, id}, k);
+            best[id] = 0;
+        }
+        if (stopRequested(token))
+            return vector<std::pair<shared_ptr<IIndexable>, short>>();
+        std::sort_heap(hits.begin(), hits.end());
+        vector<std::pair<shared_ptr<IIndexable>, short>> resultsVector;
+        resultsVector.reserve(hits.size());
+        for (const Hit &hit : hits)
+            resultsVector.emplace_back(item(hit.id), matchScore(hit.score, 1));
+        return resultsVector;
+    }
+
+
+
+    /** ***********************************************************************/
+    static void pushHit(vector<Hit> &hits, const Hit &hit, size_t k) {
+        // A bounded heap, the worst of the best k on top
+        if (hits.size() < k) {
+            hits.push_back(hit);
+            std::push_heap(hits.begin(), hits.end());
+        } else if (hit < hits.front()) {
+            std::pop_heap(hits.begin(), hits.end());
+            hits.back() = hit;
+            std::push_heap(hits.begin(), hits.end());
+        }
+    }
+
+
+
+    /** ***********************************************************************/
+    vector<uint32_t> &denseScores() const {
+        // Per item scores of the current thread, all zero between uses
+        static thread_local vector<uint32_t> scores;
+        if (scores.size() < size())
+            scores.resize(size(), 0);
+        return scores;
+    }
+
+
+
+    /** ***********************************************************************/
+    void prefixUnion(const QString &prefix, vector<uint32_t> &ids, vector<uint16_t> &scores,
+                     const CancellationToken *token) const {
+        // The ids of the delta are greater than the ids of the base, hence
+        // uniting both separately keeps the result sorted.
+        prefixUnion(*base_, prefix, ids, scores, token);
+        prefixUnion(*deltaIndex_, prefix, ids, scores, token);
+    }
+
+
+
+    /** ***********************************************************************/
+    void prefixUnion(const TermIndex &index, const QString &prefix,
+                     vector<uint32_t> &ids, vector<uint16_t> &scores,
+                     const CancellationToken *token) const {
+        // Unite the postings of all terms starting with prefix. The best
+        // score per item is collected in the dense array.
+        static thread_local vector<TermIndex::Posting> postings;
+        vector<uint32_t> &best = denseScores();
+        const size_t begin = ids.size();
+        std::pair<uint32_t, uint32_t> range = index.prefixRange(prefix);
+        for (uint32_t t = range.first; t != range.second; ++t) {
+            // A stopped union is incomplete but leaves the array clean
+            if (stopRequested(token))
+                break;
+            const double factor = matchFactor(prefix.size(), index.termSize(t), 0);
+            postings.clear();
+            index.postings(t, postings);
+            for (const TermIndex::Posting &posting : postings) {
+                const uint32_t score = static_cast<uint32_t>(posting.relevance * factor) + 1;
+                if (best[posting.id] < score)
+                    best[posting.id] = score;
+                ids.push_back(posting.id);
+            }
+        }
+
+        // Sort small unions, use a bitmap over the item ids for large ones.
+        // The postings of a single term are duplicate free already.
+        if (range.second - range.first > 1) {
+            if (ids.size() - begin < size() / 64) {
+                std::sort(ids.begin() + static_cast<std::ptrdiff_t>(begin), ids.end());
+                ids.erase(std::unique(ids.begin() + static_cast<std::ptrdiff_t>(begin), ids.end()), ids.end());
+            } else {
+                static thread_local vector<uint64_t> bitmap;
+                bitmap.assign((size() + 63) / 64, 0);
+                for (size_t i = begin; i < ids.size(); ++i)
+                    bitmap[ids[i] / 64] |= uint64_t(1) << (ids[i] % 64);
+                ids.resize(begin);
+                for (size_t w = 0; w < bitmap.size(); ++w)
+                    for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1)
+                        ids.push_back(static_cast<uint32_t>(w * 64 + __builtin_ctzll(bits)));
+            }
+        }
+
+        // Collect the scores and reset the array
+        for (size_t i = begin; i < ids.size(); ++i) {
+            scores.push_back(static_cast<uint16_t>(best[ids[i]] - 1));
+            best[ids[i]] = 0;
+        }
+    }
+
+    // Minimal size of the delta (or the removed items) to trigger a compaction
+    static const uint64_t MIN_COMPACTION = 4096;
+
+    // The id mapping of the items dropped by compaction or export
+    enum : uint32_t { REMOVED = 0xFFFFFFFF };
+
+    // Rough cost of filtering a candidate, in bytes of decoded postings
+    static const uint64_t FILTER_COST = 4;
+
+    // Sessions unite the postings of single words up to this size, in bytes
+    static const uint64_t MAX_CACHED_UNION = 1 << 16;
+
+    // The number of candidates filtered between two polls of the token
+    static const size_t STOP_POLL_INTERVAL = 1024;
+
+    // The compacted index and its items. Immutable, shared by the snapshots.
+    shared_ptr<const vector<shared_ptr<IIndexable>>> baseItems_;
+    shared_ptr<const TermIndex> base_;
+
+    // The (small) index of the items added since, ids continue the base ids
+    vector<shared_ptr<IIndexable>> deltaItems_;
+    shared_ptr<const TermIndex> deltaIndex_;
+
+    // Bitmap of the removed items, dropped on compaction
+    vector<uint64_t> removed_;
+    uint64_t removedCount_ = 0;
+
+    // The postings of the delta. Not part of the snapshots.
+    TermIndex::Postings pending_;
+    uint64_t pendingCount_ = 0;
+
+    // The ids of the live items, for removals. Not part of the snapshots.
+    std::unordered_map<const IIndexable*, uint32_t> ids_;
 };
 
 
@@ -0,0 +1,110 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <limits>
+#include "qgramindex.h"
+#include "termindex.h"
+
+namespace {
+// The q-grams are left padded with spaces, i.e. prefixes get grams too
+const QChar PADDING = QChar(' ');
+// Up to this q the units of a q-gram are packed without loss
+const unsigned int MAX_PACKED = 4;
+}
+
+
+
+/** ***************************************************************************/
+QGramIndex::QGramIndex(const TermIndex &terms, unsigned int q) {
+    // Collect (key, term, count) sorted by key and term
+    struct Entry { Key key; uint32_t term; uint32_t count; };
+    std::vector<Entry> entries;
+    std::vector<Gram> termGrams;
+    for (uint32_t t = 0; t < terms.size(); ++t) {
+        grams(terms.termData(t), terms.termSize(t), q, termGrams);
+        for (const Gram &gram : termGrams)
+            entries.push_back(Entry{gram.first, t, gram.second});
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &l, const Entry &r){
+        return l.key < r.key || (l.key == r.key && l.term < r.term);
+    });
+
+    // Group the entries by key
+    terms_.reserve(entries.size());
+    counts_.reserve(entries.size());
+    for (const Entry &entry : entries) {
+        if (keys_.empty() || keys_.back() != entry.key) {
+            if (!keys_.empty())
+                offsets_.push_back(static_cast<uint32_t>(terms_.size()));
+            keys_.push_back(entry.key);
+        }
+        terms_.push_back(entry.term);
+        counts_.push_back(static_cast<uint16_t>(std::min<uint32_t>(entry.count, std::numeric_limits<uint16_t>::max())));
+    }
+    if (!keys_.empty())
+        offsets_.push_back(static_cast<uint32_t>(terms_.size()));
+    keys_.shrink_to_fit();
+    offsets_.shrink_to_fit();
+}
+
+
+
+/** ***************************************************************************/
+void QGramIndex::grams(const QChar *word, int size, unsigned int q, std::vector<Gram> &out) {
+    out.clear();
+    if (size <= 0 || q == 0)
+        return;
+
+    // Slide a window over the padded word, one q-gram per character
+    const Key mask = (q < MAX_PACKED) ? (Key(1) << (16 * q)) - 1 : ~Key(0);
+    static thread_local std::vector<Key> keys;
+    keys.clear();
+    Key key = 0;
+    for (unsigned int i = 1; i < q; ++i)
+        key = (key << 16) | PADDING.unicode();
+    for (int i = 0; i < size; ++i) {
+        if (q <= MAX_PACKED)
+            key = ((key << 16) | word[i].unicode()) & mask;
+        else {
+            // Longer q-grams do not fit, hash them. Collisions only add
+            // candidates, which are verified by the edit distance anyway.
+            key = 0xcbf29ce484222325;
+            for (int j = i + 1 - static_cast<int>(q); j <= i; ++j)
+                key = (key ^ ((j < 0) ? PADDING : word[j]).unicode()) * 0x100000001b3;
+        }
+        keys.push_back(key);
+    }
+
+    // Count the occurrences
+    std::sort(keys.begin(), keys.end());
+    for (Key k : keys)
+        if (!out.empty() && out.back().first == k)
+            ++out.back().second;
+        else
+            out.push_back(Gram(k, 1));
+}
+
+
+
+/** ***************************************************************************/
+std::pair<uint32_t, uint32_t> QGramIndex::find(Key key) const {
+    std::vector<Key>::const_iterator it = std::lower_bound(keys_.begin(), keys_.end(), key);
+    if (it == keys_.end() || *it != key)
+        return std::make_pair(0u, 0u);
+    size_t k = static_cast<size_t>(it - keys_.begin());
+    return std::make_pair(offsets_[k], offsets_[k+1]);
+}
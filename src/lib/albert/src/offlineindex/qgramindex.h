@@ -0,0 +1,63 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QChar>
+#include <cstdint>
+#include <utility>
+#include <vector>
+class TermIndex;
+
+/**
+ * @brief The QGramIndex class
+ * An immutable index of the q-grams of the terms of a TermIndex. A q-gram is
+ * packed into an integer key, 16 bits per UTF-16 code unit (q-grams longer
+ * than four units are hashed). The keys are stored sorted, each one refers to
+ * the ascending ids of the terms containing it and to the number of
+ * occurrences in the term.
+ */
+class QGramIndex final
+{
+public:
+
+    typedef uint64_t Key;
+
+    /** A q-gram of a word and its number of occurrences */
+    typedef std::pair<Key, uint32_t> Gram;
+
+    QGramIndex() {}
+    QGramIndex(const TermIndex &terms, unsigned int q);
+
+    /** Writes the sorted, distinct q-grams of the word to out */
+    static void grams(const QChar *word, int size, unsigned int q, std::vector<Gram> &out);
+
+    /** Returns the range [first, last) of the entries of the key */
+    std::pair<uint32_t, uint32_t> find(Key key) const;
+
+    /** The term id of entry e */
+    uint32_t term(uint32_t e) const { return terms_[e]; }
+
+    /** The occurrences of the q-gram in the term of entry e */
+    uint32_t count(uint32_t e) const { return counts_[e]; }
+
+private:
+
+    std::vector<Key> keys_;
+    std::vector<uint32_t> offsets_ = std::vector<uint32_t>(1, 0);
+    std::vector<uint32_t> terms_;
+    std::vector<uint16_t> counts_;
+
+};
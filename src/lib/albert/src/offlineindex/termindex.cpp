@@ -0,0 +1,352 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "termindex.h"
+
+
+
+namespace {
+
+// Appends 8 byte aligned values and arrays
+struct Writer {
+    QByteArray &out;
+    void write(const void *data, size_t size) {
+        out.append(static_cast<const char*>(data), static_cast<int>(size));
+        out.append(static_cast<int>((8 - size % 8) % 8), '\0');
+    }
+    void write(uint64_t value) { write(&value, sizeof(value)); }
+    template<class T> void write(const MappedArray<T> &array) {
+        write(static_cast<uint64_t>(array.size()));
+        write(array.data(), array.size() * sizeof(T));
+    }
+};
+
+// Reads what the writer wrote, bounds checked
+struct Reader {
+    const char *it, *end;
+    bool ok;
+    const char *bytes(size_t size) {
+        const size_t padded = size + (8 - size % 8) % 8;
+        if (!ok || static_cast<size_t>(end - it) < padded) {
+            ok = false;
+            return nullptr;
+        }
+        const char *data = it;
+        it += padded;
+        return data;
+    }
+    uint64_t value() {
+        uint64_t result = 0;
+        if (const char *data = bytes(sizeof(result)))
+            std::memcpy(&result, data, sizeof(result));
+        return result;
+    }
+    template<class T> MappedArray<T> array() {
+        const uint64_t count = value();
+        if (count > static_cast<uint64_t>(end - it) / sizeof(T)) {
+            ok = false;
+            return MappedArray<T>();
+        }
+        const char *data = bytes(static_cast<size_t>(count) * sizeof(T));
+        return MappedArray<T>(reinterpret_cast<const T*>(data), static_cast<size_t>(count));
+    }
+};
+
+}
+
+
+
+/** ***************************************************************************/
+TermIndex::TermIndex(const Postings &postings) {
+    std::vector<QChar> chars;
+    std::vector<uint32_t> termOffsets(1, 0);
+    std::vector<uint8_t> encoded;
+    std::vector<uint32_t> postingOffsets(1, 0);
+    std::vector<uint16_t> maxRelevances;
+    termOffsets.reserve(postings.size() + 1);
+    postingOffsets.reserve(postings.size() + 1);
+    maxRelevances.reserve(postings.size());
+
+    // The map is sorted already, just concatenate the terms and encode the ids
+    for (const auto &entry : postings) {
+        chars.insert(chars.end(), entry.first.constData(), entry.first.constData() + entry.first.size());
+        termOffsets.push_back(static_cast<uint32_t>(chars.size()));
+
+        uint32_t last = 0;
+        uint16_t maxRelevance = 0;
+        for (const Posting &posting : entry.second) {
+            // Store the gap to the predecessor, seven bits per byte. Most
+            // keywords are of full relevance, store the complement.
+            encode(posting.id - last, encoded);
+            encode(0xFFFFu - posting.relevance, encoded);
+            last = posting.id;
+            maxRelevance = std::max(maxRelevance, posting.relevance);
+        }
+        maxRelevances.push_back(maxRelevance);
+        postingCount_ += entry.second.size();
+        postingOffsets.push_back(static_cast<uint32_t>(encoded.size()));
+    }
+
+    chars.shrink_to_fit();
+    encoded.shrink_to_fit();
+    chars_ = MappedArray<QChar>(std::move(chars));
+    termOffsets_ = MappedArray<uint32_t>(std::move(termOffsets));
+    postings_ = MappedArray<uint8_t>(std::move(encoded));
+    postingOffsets_ = MappedArray<uint32_t>(std::move(postingOffsets));
+    maxRelevances_ = MappedArray<uint16_t>(std::move(maxRelevances));
+
+    // Invert the postings. The ids are dense, starting at the smallest one.
+    uint32_t lastItem = 0;
+    firstItem_ = std::numeric_limits<uint32_t>::max();
+    for (const auto &entry : postings)
+        if (!entry.second.empty()) {
+            firstItem_ = std::min(firstItem_, entry.second.front().id);
+            lastItem = std::max(lastItem, entry.second.back().id);
+        }
+    if (firstItem_ > lastItem) {
+        firstItem_ = 0;
+        itemOffsets_ = MappedArray<uint32_t>(std::vector<uint32_t>(1, 0));
+        return;
+    }
+    std::vector<uint32_t> counts(lastItem - firstItem_ + 2, 0);
+    for (const auto &entry : postings)
+        for (const Posting &posting : entry.second)
+            ++counts[posting.id - firstItem_ + 1];
+    for (size_t i = 1; i < counts.size(); ++i)
+        counts[i] += counts[i-1];
+    std::vector<ItemTerm> entries(counts.back());
+    std::vector<uint32_t> fill(counts.begin(), counts.end() - 1);
+    uint32_t t = 0;
+    for (const auto &entry : postings) {
+        for (const Posting &posting : entry.second)
+            entries[fill[posting.id - firstItem_]++] = ItemTerm{t, posting.relevance};
+        ++t;
+    }
+
+    // The terms of an item are ascending, encode them like the postings
+    std::vector<uint32_t> itemOffsets(1, 0);
+    std::vector<uint8_t> itemTerms;
+    itemOffsets.reserve(counts.size());
+    for (size_t i = 0; i + 1 < counts.size(); ++i) {
+        uint32_t last = 0;
+        for (uint32_t e = counts[i]; e != counts[i+1]; ++e) {
+            encode(entries[e].term - last, itemTerms);
+            encode(0xFFFFu - entries[e].relevance, itemTerms);
+            last = entries[e].term;
+        }
+        itemOffsets.push_back(static_cast<uint32_t>(itemTerms.size()));
+    }
+    itemTerms.shrink_to_fit();
+    itemOffsets_ = MappedArray<uint32_t>(std::move(itemOffsets));
+    itemTerms_ = MappedArray<uint8_t>(std::move(itemTerms));
+}
+
+
+
+/** ***************************************************************************/
+void TermIndex::serialize(QByteArray &out) const {
+    // Scalars first, then the arrays, each one its length followed by the
+    // elements. Everything is padded to 8 bytes, the arrays stay aligned.
+    Writer writer{out};
+    writer.write(postingCount_);
+    writer.write(static_cast<uint64_t>(firstItem_));
+    writer.write(chars_);
+    writer.write(termOffsets_);
+    writer.write(postings_);
+    writer.write(postingOffsets_);
+    writer.write(maxRelevances_);
+    writer.write(itemOffsets_);
+    writer.write(itemTerms_);
+}
+
+
+
+/** ***************************************************************************/
+std::shared_ptr<const TermIndex> TermIndex::map(const char *data, size_t size, std::shared_ptr<const void> storage) {
+    Reader reader{data, data + size, true};
+
+    std::shared_ptr<TermIndex> index = std::make_shared<TermIndex>();
+    index->postingCount_ = reader.value();
+    index->firstItem_ = static_cast<uint32_t>(reader.value());
+    index->chars_ = reader.array<QChar>();
+    index->termOffsets_ = reader.array<uint32_t>();
+    index->postings_ = reader.array<uint8_t>();
+    index->postingOffsets_ = reader.array<uint32_t>();
+    index->maxRelevances_ = reader.array<uint16_t>();
+    index->itemOffsets_ = reader.array<uint32_t>();
+    index->itemTerms_ = reader.array<uint8_t>();
+    index->storage_ = storage;
+
+    // The checksum of the file guards the content, check the structure only
+    const size_t terms = index->termOffsets_.size();
+    if (!reader.ok || terms == 0
+            || index->termOffsets_.back() != index->chars_.size()
+            || index->postingOffsets_.size() != terms
+            || index->postingOffsets_.back() != index->postings_.size()
+            || index->maxRelevances_.size() != terms - 1
+            || index->itemOffsets_.empty()
+            || index->itemOffsets_.back() != index->itemTerms_.size())
+        return nullptr;
+    return index;
+}
+
+
+
+/** ***************************************************************************/
+QString TermIndex::term(uint32_t t) const {
+    return QString(chars_.data() + termOffsets_[t],
+                   static_cast<int>(termOffsets_[t+1] - termOffsets_[t]));
+}
+
+
+
+/** ***************************************************************************/
+std::pair<uint32_t, uint32_t> TermIndex::prefixRange(const QString &prefix) const {
+    const QChar *s = prefix.constData();
+    const int len = prefix.size();
+
+    // Lower bound: first term not less than the prefix
+    uint32_t first = 0, count = size();
+    while (count > 0) {
+        uint32_t step = count / 2;
+        if (compare(first + step, s, len, false) < 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    // Upper bound: first term whose prefix is greater than the prefix
+    uint32_t last = first;
+    count = size() - first;
+    while (count > 0) {
+        uint32_t step = count / 2;
+        if (compare(last + step, s, len, true) <= 0) {
+            last += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    return std::make_pair(first, last);
+}
+
+
+
+/** ***************************************************************************/
+uint32_t TermIndex::find(const QString &term) const {
+    std::pair<uint32_t, uint32_t> range = prefixRange(term);
+    if (range.first != range.second
+            && termOffsets_[range.first+1] - termOffsets_[range.first] == static_cast<uint32_t>(term.size()))
+        return range.first;
+    return size();
+}
+
+
+
+/** ***************************************************************************/
+template<class Visitor>
+void TermIndex::decode(uint32_t t, Visitor visit) const {
+    const uint8_t *it = postings_.data() + postingOffsets_[t];
+    const uint8_t *end = postings_.data() + postingOffsets_[t+1];
+    uint32_t id = 0;
+    while (it != end) {
+        id += varint(it);
+        visit(id, static_cast<uint16_t>(0xFFFFu - varint(it)));
+    }
+}
+
+
+
+/** ***************************************************************************/
+void TermIndex::postings(uint32_t t, std::vector<uint32_t> &out) const {
+    decode(t, [&out](uint32_t id, uint16_t){ out.push_back(id); });
+}
+
+
+
+/** ***************************************************************************/
+void TermIndex::postings(uint32_t t, std::vector<Posting> &out) const {
+    decode(t, [&out](uint32_t id, uint16_t relevance){ out.push_back(Posting{id, relevance}); });
+}
+
+
+
+/** ***************************************************************************/
+void TermIndex::itemTerms(uint32_t id, std::vector<ItemTerm> &out) const {
+    if (id < firstItem_ || id - firstItem_ + 1 >= itemOffsets_.size())
+        return;
+    const uint8_t *it = itemTerms_.data() + itemOffsets_[id - firstItem_];
+    const uint8_t *end = itemTerms_.data() + itemOffsets_[id - firstItem_ + 1];
+    uint32_t t = 0;
+    while (it != end) {
+        t += varint(it);
+        out.push_back(ItemTerm{t, static_cast<uint16_t>(0xFFFFu - varint(it))});
+    }
+}
+
+
+
+/** ***************************************************************************/
+void TermIndex::encode(uint32_t value, std::vector<uint8_t> &out) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+
+
+/** ***************************************************************************/
+uint32_t TermIndex::varint(const uint8_t *&it) {
+    uint32_t value = 0;
+    int shift = 0;
+    while (*it & 0x80) {
+        value |= static_cast<uint32_t>(*it++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | static_cast<uint32_t>(*it++) << shift;
+}
+
+
+
+/** ***************************************************************************/
+TermIndex::Postings TermIndex::toPostings() const {
+    Postings result;
+    for (uint32_t t = 0; t < size(); ++t)
+        postings(t, result[term(t)]);
+    return result;
+}
+
+
+
+/** ***************************************************************************/
+int TermIndex::compare(uint32_t t, const QChar *s, int len, bool prefix) const {
+    // Compares the term (or its prefix of length len) to s, like QString does
+    const QChar *c = chars_.data() + termOffsets_[t];
+    int termLen = static_cast<int>(termOffsets_[t+1] - termOffsets_[t]);
+    if (prefix && termLen > len)
+        termLen = len;
+    const int n = std::min(termLen, len);
+    for (int i = 0; i < n; ++i)
+        if (c[i] != s[i])
+            return c[i].unicode() < s[i].unicode() ? -1 : 1;
+    return termLen - len;
+}
@@ -0,0 +1,140 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QByteArray>
+#include <QChar>
+#include <QString>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "mappedarray.h"
+
+/**
+ * @brief The TermIndex class
+ * An immutable, compact inverted index. All terms are stored lexicographically
+ * sorted in a single character arena, the postings of a term are the ascending
+ * ids of the items containing it and the relevance of the keyword containing
+ * it, delta and varint encoded into a single byte array. Terms sharing a
+ * prefix are contiguous, hence a prefix lookup is a binary search yielding a
+ * range of term ids. The reverse mapping, from the items to their terms, is
+ * kept too, encoded the same way. The arrays can be serialized and mapped
+ * back without parsing.
+ */
+class TermIndex final
+{
+public:
+
+    /** An item containing a term and the relevance of its keyword */
+    struct Posting {
+        uint32_t id;
+        uint16_t relevance;
+    };
+
+    /** A term contained by an item and the relevance of its keyword */
+    struct ItemTerm {
+        uint32_t term;
+        uint16_t relevance;
+    };
+
+    /** The build input: terms mapped to the postings, ascending by id */
+    typedef std::map<QString, std::vector<Posting>> Postings;
+
+    TermIndex() : termOffsets_(std::vector<uint32_t>(1, 0)), postingOffsets_(std::vector<uint32_t>(1, 0)),
+                  itemOffsets_(std::vector<uint32_t>(1, 0)) {}
+    explicit TermIndex(const Postings &postings);
+
+    /** Appends the serialized index to out. The native byte order is used. */
+    void serialize(QByteArray &out) const;
+
+    /**
+     * Returns an index referring to serialized data, or null if it is
+     * malformed. The data has to be 8 byte aligned and has to stay valid as
+     * long as storage is referenced.
+     */
+    static std::shared_ptr<const TermIndex> map(const char *data, size_t size, std::shared_ptr<const void> storage);
+
+    /** The number of terms */
+    uint32_t size() const { return static_cast<uint32_t>(termOffsets_.size()) - 1; }
+
+    /** The number of encoded item references */
+    uint64_t postingCount() const { return postingCount_; }
+
+    /** Returns the term with id t */
+    QString term(uint32_t t) const;
+
+    /** Returns the characters of term t, without copying */
+    const QChar *termData(uint32_t t) const { return chars_.data() + termOffsets_[t]; }
+
+    /** Returns the length of term t */
+    int termSize(uint32_t t) const { return static_cast<int>(termOffsets_[t+1] - termOffsets_[t]); }
+
+    /** Returns the range [first, last) of the terms starting with prefix */
+    std::pair<uint32_t, uint32_t> prefixRange(const QString &prefix) const;
+
+    /** Returns the id of the term or size() if it does not exist */
+    uint32_t find(const QString &term) const;
+
+    /** The highest relevance in the postings of term t, an upper bound of their scores */
+    uint16_t maxRelevance(uint32_t t) const { return maxRelevances_[t]; }
+
+    /** Appends the decoded item ids of term t to out */
+    void postings(uint32_t t, std::vector<uint32_t> &out) const;
+
+    /** Appends the decoded postings of term t to out */
+    void postings(uint32_t t, std::vector<Posting> &out) const;
+
+    /** Returns true if term t starts with prefix */
+    bool startsWith(uint32_t t, const QString &prefix) const {
+        return termSize(t) >= prefix.size() && std::equal(prefix.constData(), prefix.constData() + prefix.size(), termData(t));
+    }
+
+    /** Appends the decoded terms of item id to out, ascending by term */
+    void itemTerms(uint32_t id, std::vector<ItemTerm> &out) const;
+
+    /** Returns the number of bytes of the encoded postings of the terms in [first, last) */
+    uint32_t postingBytes(uint32_t first, uint32_t last) const { return postingOffsets_[last] - postingOffsets_[first]; }
+
+    /** Decodes the whole index back into its build input */
+    Postings toPostings() const;
+
+private:
+
+    static void encode(uint32_t value, std::vector<uint8_t> &out);
+    static uint32_t varint(const uint8_t *&it);
+
+    template<class Visitor>
+    void decode(uint32_t t, Visitor visit) const;
+
+    int compare(uint32_t t, const QChar *s, int len, bool prefix) const;
+
+    MappedArray<QChar> chars_;
+    MappedArray<uint32_t> termOffsets_;
+    MappedArray<uint8_t> postings_;
+    MappedArray<uint32_t> postingOffsets_;
+    MappedArray<uint16_t> maxRelevances_;
+    uint32_t firstItem_ = 0;
+    MappedArray<uint32_t> itemOffsets_;
+    MappedArray<uint8_t> itemTerms_;
+    uint64_t postingCount_ = 0;
+
+    // Keeps the memory alive the arrays refer to, if they do not own it
+    std::shared_ptr<const void> storage_;
+
+};
@@ -0,0 +1,126 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include "tokenizer.h"
+
+namespace {
+// The folding table entries of the code units that are dropped or split words
+const ushort SEPARATOR = 0x0000;
+const ushort DROPPED = 0xFFFF;
+// The separators of the former separator regex
+const char SEPARATORS[] = "!?<>\"'=+*.:,;\\/ _-";
+
+// Returns true for the Hangul syllables and the kana. Their decompositions
+// and voicing marks are part of the letter, not diacritics.
+bool isSyllabic(uint c) {
+    return (c >= 0xAC00 && c <= 0xD7A3) || (c >= 0x3040 && c <= 0x30FF);
+}
+
+// Returns true for the combining diacritical marks. Other nonspacing marks,
+// like the viramas and the vowel signs of the Indic and Thai scripts, are
+// part of the word and must not be dropped.
+bool isDiacritic(uint c) {
+    return (c >= 0x0300 && c <= 0x036F) || (c >= 0x1AB0 && c <= 0x1AFF)
+            || (c >= 0x1DC0 && c <= 0x1DFF) || (c >= 0x20D0 && c <= 0x20FF)
+            || (c >= 0xFE20 && c <= 0xFE2F);
+}
+}
+
+
+
+/** ***************************************************************************/
+void Tokenizer::tokenize(const QString &text, QString &folded, std::vector<Token> &tokens) {
+    const ushort *table = foldingTable().data();
+    folded.resize(text.size());
+    tokens.clear();
+
+    // Fold the code units, dropping the separators. A word ends at a separator.
+    const QChar *in = text.constData();
+    QChar *out = folded.data();
+    int size = 0, begin = 0;
+    for (int i = 0; i < text.size(); ++i) {
+        const ushort c = table[in[i].unicode()];
+        if (c == SEPARATOR) {
+            if (size > begin)
+                tokens.push_back(Token{begin, size - begin});
+            begin = size;
+        } else if (c != DROPPED)
+            out[size++] = QChar(c);
+    }
+    if (size > begin)
+        tokens.push_back(Token{begin, size - begin});
+    folded.resize(size);
+}
+
+
+
+/** ***************************************************************************/
+std::vector<QString> Tokenizer::words(const QString &text) {
+    static thread_local QString folded;
+    static thread_local std::vector<Token> tokens;
+    tokenize(text, folded, tokens);
+    std::vector<QString> words;
+    words.reserve(tokens.size());
+    for (const Token &token : tokens)
+        words.emplace_back(folded.constData() + token.offset, token.size);
+    return words;
+}
+
+
+
+/** ***************************************************************************/
+const std::vector<ushort> &Tokenizer::foldingTable() {
+    // Built once, maps every code unit of the BMP to its folded form
+    static const std::vector<ushort> table = [](){
+        std::vector<ushort> table(0x10000);
+        for (uint c = 0; c < 0x10000; ++c) {
+            const QChar qc(static_cast<ushort>(c));
+            if (qc.isHighSurrogate() || qc.isLowSurrogate()) {
+                // Supplementary characters are kept as they are
+                table[c] = static_cast<ushort>(c);
+            } else if (c == SEPARATOR || qc.isSpace()
+                       || (c < 0x80 && std::strchr(SEPARATORS, static_cast<char>(c)) != nullptr)) {
+                table[c] = SEPARATOR;
+            } else if (isSyllabic(c)) {
+                table[c] = static_cast<ushort>(c);
+            } else if (isDiacritic(c) || c == DROPPED) {
+                // Combining diacritics of decomposed text
+                table[c] = DROPPED;
+            } else {
+                // Fold the case, then strip the diacritics by taking the base
+                // character of the canonical decomposition. Only if the rest
+                // of it are diacritics, other decompositions are letters.
+                uint f = QChar::toCaseFolded(c);
+                while (QChar::decompositionTag(f) == QChar::Canonical) {
+                    const QString decomposition = QChar::decomposition(f);
+                    if (decomposition.isEmpty() || decomposition[0].isHighSurrogate()
+                            || decomposition[0].unicode() == f)
+                        break;
+                    bool marks = true;
+                    for (int i = 1; i < decomposition.size(); ++i)
+                        marks &= isDiacritic(decomposition[i].unicode());
+                    if (!marks)
+                        break;
+                    f = QChar::toCaseFolded(static_cast<uint>(decomposition[0].unicode()));
+                }
+                table[c] = static_cast<ushort>(f);
+            }
+        }
+        return table;
+    }();
+    return table;
+}
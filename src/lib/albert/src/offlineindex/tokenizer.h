@@ -0,0 +1,49 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QChar>
+#include <QString>
+#include <vector>
+
+/**
+ * @brief The Tokenizer class
+ * Splits text into the words used for indexing and querying. A single table
+ * lookup per UTF-16 code unit classifies separators and folds the case and
+ * the diacritics, e.g. "Café" yields "cafe". The words are ranges of a buffer
+ * of the caller, tokenizing does not allocate once the buffer is large enough.
+ */
+class Tokenizer final
+{
+public:
+
+    /** A word, the range [offset, offset+size) of the folded text */
+    struct Token {
+        int offset;
+        int size;
+    };
+
+    /** Writes the folded text to folded and the words in it to tokens */
+    static void tokenize(const QString &text, QString &folded, std::vector<Token> &tokens);
+
+    /** Returns the folded words of text */
+    static std::vector<QString> words(const QString &text);
+
+private:
+
+    static const std::vector<ushort> &foldingTable();
+
+};
@@ -30,6 +30,9 @@
 using std::vector;
 
 namespace  {
+    // The interval in ms a query polls its token while waiting for a process
+    const int PROCESS_POLL_INTERVAL = 20;
+
     vector<SharedItem> buildItemFromJson(const QByteArray &a){
 
         vector<SharedItem> result;
@@ -179,6 +182,14 @@ QStringList ExternalExtension::triggers() const {
 
 
 
+/** ***************************************************************************/
+int ExternalExtension::maxConcurrentQueries() const {
+    // Every query spawns a process, do not pile them up
+    return 1;
+}
+
+
+
 /** ***************************************************************************/
 void ExternalExtension::setupSession() {
     QProcess::startDetached(path_, {"SETUPSESSION"});
@@ -199,10 +210,20 @@ void ExternalExtension::handleQuery(AbstractQuery* query) {
     if (!providesMatches_)
         return;
 
+    const CancellationToken &token = query->token();
+    if (token.stopRequested())
+        return;
+
+    // Wait in slices, kill the process as soon as the query gets stale
     QProcess extProc;
     extProc.start(path_, {"QUERY", query->searchTerm()});
-    if (!extProc.waitForFinished(1000))
-        return;
+    while (!extProc.waitForFinished(PROCESS_POLL_INTERVAL)) {
+        if (extProc.state() == QProcess::NotRunning || token.stopRequested()) {
+            extProc.kill();
+            extProc.waitForFinished(PROCESS_POLL_INTERVAL);
+            return;
+        }
+    }
     for (SharedItem &item : buildItemFromJson(extProc.readAllStandardOutput()))
         query->addMatch(item);
 }
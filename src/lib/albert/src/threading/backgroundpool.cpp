@@ -0,0 +1,60 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include "backgroundpool.h"
+
+namespace {
+
+// Runs a job at idle priority and deletes it afterwards if it wants so
+class IdleRunnable final : public QRunnable
+{
+public:
+    explicit IdleRunnable(QRunnable *runnable) : runnable_(runnable) {}
+    void run() override {
+        QThread::currentThread()->setPriority(QThread::IdlePriority);
+        runnable_->run();
+        if (runnable_->autoDelete())
+            delete runnable_;
+    }
+private:
+    QRunnable *runnable_;
+};
+
+}
+
+
+
+/** ***************************************************************************/
+void BackgroundPool::start(QRunnable *runnable) {
+    instance()->start(new IdleRunnable(runnable));
+}
+
+
+
+/** ***************************************************************************/
+QThreadPool *BackgroundPool::instance() {
+    // Half of the cores at most, the other half is left for the queries
+    static QThreadPool *pool = [](){
+        QThreadPool *pool = new QThreadPool;
+        pool->setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+        return pool;
+    }();
+    return pool;
+}
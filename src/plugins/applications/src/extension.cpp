@@ -21,12 +21,12 @@
 #include <QMessageBox>
 #include <QSettings>
 #include <QStandardPaths>
-#include <QThreadPool>
 #include <memory>
 #include "extension.h"
 #include "configwidget.h"
 #include "indexer.h"
 #include "abstractquery.h"
+#include "backgroundpool.h"
 #include "standardobjects.h"
 
 const char* Applications::Extension::CFG_PATHS    = "paths";
@@ -128,15 +128,13 @@ QWidget *Applications::Extension::widget(QWidget *parent) {
 
 /** ***************************************************************************/
 void Applications::Extension::handleQuery(AbstractQuery * query) {
-    // Search for matches. Lock memory against scanworker
-    indexAccess_.lock();
-    vector<shared_ptr<IIndexable>> indexables = offlineIndex_.search(query->searchTerm().toLower());
-    indexAccess_.unlock();
+    // Search for matches. The index publishes snapshots, no locking needed.
+    // The search stops early if the query gets stale.
+    vector<std::pair<shared_ptr<IIndexable>,short>> indexables = offlineIndex_.search(query->searchTerm().toLower(), &query->token(), query->session());
 
     // Add results to query-> This cast is safe since index holds files only
-    for (const shared_ptr<IIndexable> &obj : indexables)
-        // TODO `Search` has to determine the relevance. Set to 0 for now
-        query->addMatch(std::static_pointer_cast<StandardIndexItem>(obj), 0);
+    for (const std::pair<shared_ptr<IIndexable>,short> &obj : indexables)
+        query->addMatch(std::static_pointer_cast<StandardIndexItem>(obj.first), obj.second);
 }
 
 
@@ -242,7 +240,7 @@ void Applications::Extension::updateIndex() {
         indexer_ = new Indexer(this);
 
         //  Run it
-        QThreadPool::globalInstance()->start(indexer_);
+        BackgroundPool::start(indexer_);
 
         // If widget is visible show the information in the status bat
         if (!widget_.isNull())
@@ -16,16 +16,19 @@
 
 #pragma once
 #include <QFileSystemWatcher>
+#include <QDateTime>
 #include <QPointer>
 #include <QObject>
 #include <QString>
 #include <QMutex>
 #include <QTimer>
 #include <QList>
+#include <map>
 #include <vector>
 #include <memory>
 #include "abstractextension.h"
 #include "offlineindex.h"
+using std::map;
 using std::vector;
 using std::shared_ptr;
 class StandardIndexItem;
@@ -71,6 +74,9 @@ public:
 private:
     QPointer<ConfigWidget> widget_;
     vector<shared_ptr<StandardIndexItem>> index_;
+    map<QString, shared_ptr<StandardIndexItem>> desktopFiles_; // The items by file path
+    QDateTime lastIndexRun_;
+    QString lastTerminalCommand_; // The terminal the actions of the items use
     OfflineIndex offlineIndex_;
     QMutex indexAccess_;
     QPointer<Indexer> indexer_;
@@ -15,6 +15,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QApplication>
+#include <QDateTime>
 #include <QDirIterator>
 #include <QDebug>
 #include <QThread>
@@ -23,6 +24,7 @@
 #include <QRegularExpression>
 #include <QString>
 #include <map>
+#include <set>
 #include <vector>
 #include <memory>
 #include <algorithm>
@@ -250,6 +252,9 @@ void Applications::Extension::Indexer::run() {
 
     // Get a new index [O(n)]
     vector<SharedStdIdxItem> desktopEntries;
+    map<QString, SharedStdIdxItem> desktopFiles;
+    QDateTime start = QDateTime::currentDateTime();
+    const QString terminal = terminalCommand;
     QStringList xdg_current_desktop = QString(getenv("XDG_CURRENT_DESKTOP")).split(':',QString::SkipEmptyParts);
     QLocale loc;
 
@@ -264,6 +269,18 @@ void Applications::Extension::Indexer::run() {
             if (abort_)
                 return;
 
+            // Reuse the item of the last run if the file has not been modified.
+            // The actions of terminal apps embed the terminal command.
+            const QString filePath = fIt.next();
+            map<QString, SharedStdIdxItem>::const_iterator it = extension_->desktopFiles_.find(filePath);
+            if (it != extension_->desktopFiles_.end()
+                    && fIt.fileInfo().lastModified() < extension_->lastIndexRun_
+                    && terminal == extension_->lastTerminalCommand_) {
+                desktopFiles.emplace(filePath, it->second);
+                desktopEntries.push_back(it->second);
+                continue;
+            }
+
             map<QString,map<QString,QString>> sectionMap;
             map<QString,map<QString,QString>>::iterator sectionIterator;
 
@@ -273,7 +290,7 @@ void Applications::Extension::Indexer::run() {
 
             // Read the file into a map
             {
-            QFile file(fIt.next());
+            QFile file(filePath);
             if (!file.open(QIODevice::ReadOnly| QIODevice::Text)) continue;
             QTextStream stream(&file);
             QString currentGroup;
@@ -393,8 +410,8 @@ void Applications::Extension::Indexer::run() {
             SharedStdAction sa = std::make_shared<StandardAction>();
             sa->setText("Run");
             if (term){
-                sa->setAction([commandline, workingDir](){
-                    QStringList arguments = shellLexerSplit(terminalCommand);
+                sa->setAction([commandline, workingDir, terminal](){
+                    QStringList arguments = shellLexerSplit(terminal);
                     arguments.append(commandline);
                     QString command = arguments.takeFirst();
                     QProcess::startDetached(command, arguments, workingDir);
@@ -417,8 +434,8 @@ void Applications::Extension::Indexer::run() {
             if (term){
                 sa = std::make_shared<StandardAction>();
                 sa->setText("Run as root");
-                sa->setAction([commandline, workingDir](){
-                    QStringList arguments = shellLexerSplit(terminalCommand);
+                sa->setAction([commandline, workingDir, terminal](){
+                    QStringList arguments = shellLexerSplit(terminal);
                     arguments.append("sudo");
                     arguments.append(commandline);
                     QString command = arguments.takeFirst();
@@ -476,8 +493,8 @@ void Applications::Extension::Indexer::run() {
                                                              fIt.filePath());
 
                 if (term){
-                    sa->setAction([commandline, workingDir](){
-                        QStringList arguments = shellLexerSplit(terminalCommand);
+                    sa->setAction([commandline, workingDir, terminal](){
+                        QStringList arguments = shellLexerSplit(terminal);
                         arguments.append(commandline);
                         QString command = arguments.takeFirst();
                         QProcess::startDetached(command, arguments, workingDir);
@@ -535,10 +552,25 @@ void Applications::Extension::Indexer::run() {
             // Set actions
             ssii->setActions(std::move(actions));
 
+            desktopFiles.emplace(filePath, ssii);
             desktopEntries.push_back(std::move(ssii));
         }
     }
 
+    // Compute the changes. Reused items are identical.
+    std::set<StandardIndexItem*> oldItems, newItems;
+    for (const SharedStdIdxItem &item : extension_->index_)
+        oldItems.insert(item.get());
+    for (const SharedStdIdxItem &item : desktopEntries)
+        newItems.insert(item.get());
+    vector<shared_ptr<IIndexable>> added, removed;
+    for (const SharedStdIdxItem &item : desktopEntries)
+        if (oldItems.count(item.get()) == 0)
+            added.push_back(item);
+    for (const SharedStdIdxItem &item : extension_->index_)
+        if (newItems.count(item.get()) == 0)
+            removed.push_back(item);
+
 
     /*
      *  ▼ CRITICAL ▼
@@ -553,11 +585,12 @@ void Applications::Extension::Indexer::run() {
 
     // Set the new index (use swap to shift destruction out of critical area)
     std::swap(extension_->index_, desktopEntries);
+    std::swap(extension_->desktopFiles_, desktopFiles);
+    extension_->lastIndexRun_ = start;
+    extension_->lastTerminalCommand_ = terminal;
 
-    // Rebuild the offline index
-    extension_->offlineIndex_.clear();
-    for (const auto &item : extension_->index_)
-        extension_->offlineIndex_.add(item);
+    // Update the offline index
+    extension_->offlineIndex_.applyDelta(added, removed);
 
     // Finally update the watches (maybe folders changed)
     if (!extension_->watcher_.directories().isEmpty())
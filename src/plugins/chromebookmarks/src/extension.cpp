@@ -17,7 +17,6 @@
 #include <QStandardPaths>
 #include <QSettings>
 #include <QDirIterator>
-#include <QThreadPool>
 #include <QFileInfo>
 #include <QProcess>
 #include <QDebug>
@@ -27,6 +26,7 @@
 #include "configwidget.h"
 #include "indexer.h"
 #include "abstractquery.h"
+#include "backgroundpool.h"
 #include "standardobjects.h"
 
 const char* ChromeBookmarks::Extension::CFG_PATH       = "bookmarkfile";
@@ -114,15 +114,13 @@ QWidget *ChromeBookmarks::Extension::widget(QWidget *parent) {
 
 /** ***************************************************************************/
 void ChromeBookmarks::Extension::handleQuery(AbstractQuery * query) {
-    // Search for matches. Lock memory against indexer
-    indexAccess_.lock();
-    vector<shared_ptr<IIndexable>> indexables = offlineIndex_.search(query->searchTerm().toLower());
-    indexAccess_.unlock();
+    // Search for matches. The index publishes snapshots, no locking needed.
+    // The search stops early if the query gets stale.
+    vector<std::pair<shared_ptr<IIndexable>,short>> indexables = offlineIndex_.search(query->searchTerm().toLower(), &query->token(), query->session());
 
     // Add results to query-> This cast is safe since index holds files only
-    for (const shared_ptr<IIndexable> &obj : indexables)
-        // TODO `Search` has to determine the relevance. Set to 0 for now
-        query->addMatch(std::static_pointer_cast<StandardIndexItem>(obj), 0);
+    for (const std::pair<shared_ptr<IIndexable>,short> &obj : indexables)
+        query->addMatch(std::static_pointer_cast<StandardIndexItem>(obj.first), obj.second);
 }
 
 
@@ -176,7 +174,7 @@ void ChromeBookmarks::Extension::updateIndex() {
         indexer_ = new Indexer(this);
 
         //  Run it
-        QThreadPool::globalInstance()->start(indexer_);
+        BackgroundPool::start(indexer_);
 
         // If widget is visible show the information in the status bat
         if (!widget_.isNull())
@@ -188,9 +186,7 @@ void ChromeBookmarks::Extension::updateIndex() {
 
 /** ***************************************************************************/
 void ChromeBookmarks::Extension::setFuzzy(bool b) {
-    indexAccess_.lock();
     QSettings(qApp->applicationName()).setValue(QString("%1/%2").arg(id, CFG_FUZZY), b);
     offlineIndex_.setFuzzy(b);
-    indexAccess_.unlock();
 }
 
@@ -24,11 +24,13 @@
 #include <QJsonObject>
 #include <QUrl>
 #include <functional>
+#include <map>
 #include <memory>
 #include <vector>
 #include "extension.h"
 #include "indexer.h"
 #include "standardobjects.h"
+using std::map;
 using std::shared_ptr;
 using std::vector;
 
@@ -105,6 +107,25 @@ void ChromeBookmarks::Extension::Indexer::run() {
 
     f.close();
 
+    // Compute the changes. Keep the unchanged bookmarks of the old index.
+    map<QString, SharedStdIdxItem> oldBookmarks;
+    for (const SharedStdIdxItem &item : extension_->index_)
+        oldBookmarks.emplace(item->id(), item);
+    vector<shared_ptr<IIndexable>> added;
+    for (SharedStdIdxItem &item : bookmarks) {
+        map<QString, SharedStdIdxItem>::iterator it = oldBookmarks.find(item->id());
+        if (it != oldBookmarks.end()
+                && it->second->text() == item->text()
+                && it->second->subtext() == item->subtext()) {
+            item = it->second;
+            oldBookmarks.erase(it);
+        } else
+            added.push_back(item);
+    }
+    vector<shared_ptr<IIndexable>> removed;
+    for (auto &entry : oldBookmarks)
+        removed.push_back(entry.second);
+
     /*
      *  ▼ CRITICAL ▼
      */
@@ -119,10 +140,8 @@ void ChromeBookmarks::Extension::Indexer::run() {
     // Set the new index (use swap to shift destruction out of critical area)
     std::swap(extension_->index_, bookmarks);
 
-    // Rebuild the offline index
-    extension_->offlineIndex_.clear();
-    for (const auto &item : extension_->index_)
-        extension_->offlineIndex_.add(item);
+    // Update the offline index
+    extension_->offlineIndex_.applyDelta(added, removed);
 
     /*
      * Finally update the watches (maybe folders changed)
@@ -17,6 +17,7 @@
 #include <QApplication>
 #include <QDebug>
 #include <QSettings>
+#include <algorithm>
 #include <chrono>
 #include <thread>
 #include "configwidget.h"
@@ -54,15 +55,17 @@ QWidget *Debug::Extension::widget(QWidget *parent) {
 
 /** ***************************************************************************/
 void Debug::Extension::handleQuery(AbstractQuery * query) {
-    if (!query->isValid())
+    const CancellationToken &token = query->token();
+    if (token.stopRequested())
         return;
 
     for (int i = 0 ; i < count_; ++i){
 
+        // Do not sleep past the deadline of the query
         if (async_)
-            std::this_thread::sleep_for(std::chrono::milliseconds(delay_));
+            std::this_thread::sleep_for(std::min(std::chrono::milliseconds(delay_), token.remaining()));
 
-        if (!query->isValid())
+        if (token.stopRequested())
             return;
 
         std::shared_ptr<StandardItem> item = std::make_shared<StandardItem>(QString::number(i));
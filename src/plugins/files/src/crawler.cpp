@@ -0,0 +1,397 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include "backgroundpool.h"
+#include "crawler.h"
+#include "file.h"
+
+namespace {
+
+// The record layout of getdents64, not exposed by the libc headers
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+class Worker final : public QRunnable
+{
+public:
+    explicit Worker(std::function<void()> work) : work_(work) {}
+    void run() override {
+        QThread::currentThread()->setPriority(QThread::IdlePriority);
+        work_();
+    }
+private:
+    std::function<void()> work_;
+};
+
+}
+
+
+
+/** ***************************************************************************/
+Files::Crawler::Crawler(const Options &options, const MimeClassifier &classifier, const std::atomic<bool> &abort)
+    : options_(options), abort_(abort), classifier_(classifier), pending_(0), queued_(0), scanned_(0),
+      visited_(new Shard[VISITED_SHARDS]),
+      dirMimeId_(File::internMimeName(QStringLiteral("inode/directory"))) {
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::crawl(const QStringList &paths, size_t threads, std::function<void(const QString&)> watch,
+                           std::function<void(const QString&)> progress) {
+    watch_ = watch;
+    progress_ = progress;
+
+    // A queue and a buffer per thread. This thread works too. Indexing gets
+    // the cores of the background pool, not more.
+    threads = std::max<size_t>(1, std::min<size_t>(threads, static_cast<size_t>(BackgroundPool::instance()->maxThreadCount())));
+    queues_.clear();
+    for (size_t i = 0; i < threads; ++i)
+        queues_.emplace_back(new Queue);
+    buffers_.assign(threads, Buffer());
+
+    // Distribute the dirs among the queues, index the files right away
+    QMimeDatabase mimeDatabase;
+    size_t next = 0;
+    for (const QString &path : paths) {
+        const QFileInfo fileInfo(path);
+        const QString canonicalPath = fileInfo.canonicalFilePath();
+        if (canonicalPath.isEmpty())
+            continue;
+        if (fileInfo.isDir())
+            push(next++ % threads, Task{QFile::encodeName(canonicalPath).toStdString(), Dir::fromPath(canonicalPath)});
+        else if (fileInfo.isFile())
+            addFile(canonicalPath, mimeDatabase, buffers_[0]);
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(static_cast<int>(threads) - 1);
+    for (size_t i = 1; i < threads; ++i)
+        pool.start(new Worker([this, i](){ work(i); }));
+    work(0);
+    pool.waitForDone();
+
+    // Merge the buffers
+    size_t size = 0;
+    for (const Buffer &buffer : buffers_)
+        size += buffer.files.size();
+    files_.reserve(files_.size() + size);
+    for (Buffer &buffer : buffers_) {
+        std::move(buffer.files.begin(), buffer.files.end(), std::back_inserter(files_));
+        dirs_.insert(buffer.dirs.begin(), buffer.dirs.end());
+    }
+    buffers_.clear();
+    queues_.clear();
+}
+
+
+
+/** ***************************************************************************/
+bool Files::Crawler::skip(const QString &path) const {
+    const QFileInfo fileInfo(path);
+    const QString fileName = fileInfo.fileName();
+
+    // Skip if this file is hidden and we should skip hidden files
+    if (fileInfo.isHidden() && !options_.indexHidden)
+        return true;
+
+    // Skip if this file matches one of the ignore patterns of its dir
+    QByteArray ignoreFile;
+    QFile file(QDir(fileInfo.path()).filePath(options_.ignoreFile));
+    if (file.open(QIODevice::ReadOnly))
+        ignoreFile = file.readAll();
+    if (ignored(fileName, ignores(ignoreFile)))
+        return true;
+
+    // Skip if this file is a symlink and we shoud skip symlinks
+    return fileInfo.isSymLink() && !options_.followSymlinks;
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::work(size_t self) {
+    QMimeDatabase mimeDatabase;
+    Task task;
+    while (!abort_) {
+        if (pop(self, task) || steal(self, task)) {
+            scan(task, self, mimeDatabase);
+            if (--pending_ == 0) {
+                QMutexLocker locker(&idleMutex_);
+                idle_.wakeAll();
+            }
+        } else {
+            // Others are still scanning, wait for their subdirs
+            QMutexLocker locker(&idleMutex_);
+            if (pending_ == 0)
+                return;
+            while (queued_ == 0 && pending_ != 0 && !abort_)
+                idle_.wait(&idleMutex_);
+        }
+    }
+
+    // Aborted, wake the waiting threads. The dirs queued are never scanned.
+    QMutexLocker locker(&idleMutex_);
+    idle_.wakeAll();
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::scan(const Task &task, size_t self, QMimeDatabase &mimeDatabase) {
+    Buffer &buffer = buffers_[self];
+    const std::string &dir = task.path;
+
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    // Skip if this dir has already been indexed, it is reachable by symlinks
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !visit(st.st_dev, st.st_ino)) {
+        close(fd);
+        return;
+    }
+
+    // Watch the dir before reading it, the changes meanwhile are not missed
+    const QString dirPath = QFile::decodeName(dir.c_str());
+    if (watch_)
+        watch_(dirPath);
+    buffer.dirs.push_back(dirPath);
+    if (++scanned_ % PROGRESS_INTERVAL == 0 && progress_)
+        progress_(dirPath);
+
+    // If the dir matches the index options, index it
+    if (options_.indexDirs) {
+        if (task.dir->parent())
+            buffer.files.push_back(std::make_shared<File>(task.dir->parent(), task.dir->name(), dirMimeId_));
+        else
+            buffer.files.push_back(std::make_shared<File>(task.dir, QString(), dirMimeId_));
+    }
+
+    // Read the ignore file of the dir
+    QByteArray ignoreFile;
+    const int ignoreFd = openat(fd, QFile::encodeName(options_.ignoreFile).constData(), O_RDONLY | O_CLOEXEC);
+    if (ignoreFd >= 0) {
+        char chunk[4096];
+        ssize_t n;
+        while ((n = read(ignoreFd, chunk, sizeof(chunk))) > 0)
+            ignoreFile.append(chunk, static_cast<int>(n));
+        close(ignoreFd);
+    }
+    const std::vector<QRegExp> ignorePatterns = ignores(ignoreFile);
+
+    // Walk the entries. Stat them relative to the open dir if the fs does
+    // not report their type.
+    const std::string prefix = (dir == "/") ? dir : dir + '/';
+    alignas(LinuxDirent64) char entries[32768];
+    long size;
+    while (!abort_ && (size = syscall(SYS_getdents64, fd, entries, sizeof(entries))) > 0) {
+        for (long offset = 0; offset < size;) {
+            const LinuxDirent64 *entry = reinterpret_cast<const LinuxDirent64*>(entries + offset);
+            offset += entry->d_reclen;
+            const char *name = entry->d_name;
+
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0)
+                continue;
+
+            // Skip if this file is hidden and we should skip hidden files
+            if (name[0] == '.' && !options_.indexHidden)
+                continue;
+
+            // Skip if this file matches one of the ignore patterns
+            const QString fileName = QFile::decodeName(name);
+            if (ignored(fileName, ignorePatterns))
+                continue;
+
+            unsigned char type = entry->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat entryStat;
+                if (fstatat(fd, name, &entryStat, AT_SYMLINK_NOFOLLOW) != 0)
+                    continue;
+                type = S_ISDIR(entryStat.st_mode) ? DT_DIR
+                     : S_ISREG(entryStat.st_mode) ? DT_REG
+                     : S_ISLNK(entryStat.st_mode) ? DT_LNK : DT_UNKNOWN;
+            }
+
+            if (type == DT_LNK) {
+                // Skip if we shoud skip symlinks, index the target otherwise
+                if (!options_.followSymlinks)
+                    continue;
+                char *target = realpath((prefix + name).c_str(), nullptr);
+                if (!target)
+                    continue;
+                const std::string path = target;
+                free(target);
+                struct stat targetStat;
+                if (stat(path.c_str(), &targetStat) != 0)
+                    continue;
+                if (S_ISDIR(targetStat.st_mode))
+                    push(self, Task{path, Dir::fromPath(QFile::decodeName(path.c_str()))});
+                else if (S_ISREG(targetStat.st_mode))
+                    addFile(QFile::decodeName(path.c_str()), mimeDatabase, buffer);
+            } else if (type == DT_DIR)
+                push(self, Task{prefix + name, std::make_shared<const Dir>(task.dir, fileName)});
+            else if (type == DT_REG)
+                addFile(task.dir, dirPath, fileName, mimeDatabase, buffer);
+        }
+    }
+    close(fd);
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::push(size_t self, Task &&task) {
+    ++pending_;
+    {
+        QMutexLocker locker(&queues_[self]->mutex);
+        queues_[self]->tasks.push_back(std::move(task));
+        ++queued_;
+    }
+    QMutexLocker locker(&idleMutex_);
+    idle_.wakeOne();
+}
+
+
+
+/** ***************************************************************************/
+bool Files::Crawler::pop(size_t self, Task &task) {
+    // Depth first, the newest dir is the one closest to the last scanned
+    QMutexLocker locker(&queues_[self]->mutex);
+    std::deque<Task> &tasks = queues_[self]->tasks;
+    if (tasks.empty())
+        return false;
+    task = std::move(tasks.back());
+    tasks.pop_back();
+    --queued_;
+    return true;
+}
+
+
+
+/** ***************************************************************************/
+bool Files::Crawler::steal(size_t self, Task &task) {
+    // Take the oldest dir, it is likely the root of the largest subtree
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        Queue &victim = *queues_[(self + i) % queues_.size()];
+        QMutexLocker locker(&victim.mutex);
+        if (victim.tasks.empty())
+            continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued_;
+        return true;
+    }
+    return false;
+}
+
+
+
+/** ***************************************************************************/
+bool Files::Crawler::visit(dev_t device, ino_t inode) {
+    Shard &shard = visited_[(std::hash<ino_t>()(inode) ^ std::hash<dev_t>()(device)) % VISITED_SHARDS];
+    QMutexLocker locker(&shard.mutex);
+    return shard.dirs.insert(std::make_pair(device, inode)).second;
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::addFile(const QString &path, QMimeDatabase &mimeDatabase, Buffer &buffer) const {
+    const int slash = path.lastIndexOf('/');
+    const QString dirPath = (slash > 0) ? path.left(slash) : QString();
+    addFile(Dir::fromPath(dirPath), dirPath, path.mid(slash + 1), mimeDatabase, buffer);
+}
+
+
+
+/** ***************************************************************************/
+void Files::Crawler::addFile(const std::shared_ptr<const Dir> &dir, const QString &dirPath, const QString &name,
+                             QMimeDatabase &mimeDatabase, Buffer &buffer) const {
+    // If the file matches the index options, index it. Decide by the name if
+    // possible, the mimetype itself is resolved when the file is displayed.
+    QString mimeName;
+    switch (classifier_.classify(dirPath, name, mimeDatabase, mimeName)) {
+    case MimeClassifier::Category::Audio:
+        if (!options_.indexAudio) return;
+        break;
+    case MimeClassifier::Category::Video:
+        if (!options_.indexVideo) return;
+        break;
+    case MimeClassifier::Category::Image:
+        if (!options_.indexImage) return;
+        break;
+    case MimeClassifier::Category::Document:
+        if (!options_.indexDocs) return;
+        break;
+    case MimeClassifier::Category::Other:
+        return;
+    }
+    std::map<QString, uint16_t>::const_iterator it = buffer.mimeIds.find(mimeName);
+    if (it == buffer.mimeIds.end())
+        it = buffer.mimeIds.emplace(mimeName, File::internMimeName(mimeName)).first;
+    buffer.files.push_back(std::make_shared<File>(dir, name, it->second));
+}
+
+
+
+/** ***************************************************************************/
+bool Files::Crawler::ignored(const QString &name, const std::vector<QRegExp> &ignores) const {
+    for (const QRegExp& ignore : ignores)
+        if(ignore.exactMatch(name))
+            return true;
+    return false;
+}
+
+
+
+/** ***************************************************************************/
+std::vector<QRegExp> Files::Crawler::ignores(const QByteArray &ignoreFile) const {
+    // Ignore ignorefile by default
+    std::vector<QRegExp> ignores;
+    ignores.push_back(QRegExp(options_.ignoreFile, Qt::CaseSensitive, QRegExp::Wildcard));
+
+    // See http://doc.qt.io/qt-5/qregexp.html#wildcard-matching
+    for (const QByteArray &line : ignoreFile.split('\n')) {
+        const QString pattern = QString::fromLocal8Bit(line).trimmed();
+        if (!pattern.isEmpty())
+            ignores.push_back(QRegExp(pattern, Qt::CaseSensitive, QRegExp::Wildcard));
+    }
+    return ignores;
+}
@@ -0,0 +1,152 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QByteArray>
+#include <QMutex>
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+#include <QWaitCondition>
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "mimeclassifier.h"
+class QMimeDatabase;
+
+namespace Files {
+
+class Dir;
+class File;
+
+/**
+ * @brief The Crawler class
+ * Walks directory trees on several threads. Every thread owns a queue of dirs,
+ * pushes the subdirs it finds to it and takes the next one from it, depth
+ * first. Idle threads steal the oldest dirs of the other queues or wait for
+ * new ones. The dirs are read by getdents64, the entries are checked relative
+ * to the open dir.
+ * Every thread collects its results in buffers of its own, merged at the end.
+ * The files in a dir share its node of the dir tree.
+ */
+class Crawler final
+{
+public:
+
+    struct Options {
+        bool indexAudio;
+        bool indexVideo;
+        bool indexImage;
+        bool indexDocs;
+        bool indexDirs;
+        bool indexHidden;
+        bool followSymlinks;
+        QString ignoreFile;
+    };
+
+    Crawler(const Options &options, const MimeClassifier &classifier, const std::atomic<bool> &abort);
+
+    /**
+     * Indexes the paths and the trees below
+     * @param paths The files and dirs to index
+     * @param threads The threads to use, the calling one included. At most as
+     * many as the background pool has.
+     * @param watch Called with every dir before it is read, from any thread
+     * @param progress Called with a dir every now and then, from any thread
+     */
+    void crawl(const QStringList &paths, size_t threads, std::function<void(const QString&)> watch,
+               std::function<void(const QString&)> progress);
+
+    /** The indexed files, unsorted */
+    std::vector<std::shared_ptr<File>> &files() { return files_; }
+
+    /** The canonical paths of the crawled dirs */
+    std::set<QString> &dirs() { return dirs_; }
+
+    /** True if the file at path is excluded by the options or the ignore file of its dir */
+    bool skip(const QString &path) const;
+
+private:
+
+    // A dir to scan, its node is shared by the files in it
+    struct Task {
+        std::string path;
+        std::shared_ptr<const Dir> dir;
+    };
+
+    struct Queue {
+        QMutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    struct Buffer {
+        std::vector<std::shared_ptr<File>> files;
+        std::vector<QString> dirs;
+        std::map<QString, uint16_t> mimeIds; // Saves locking the shared table
+    };
+
+    void work(size_t self);
+    void scan(const Task &task, size_t self, QMimeDatabase &mimeDatabase);
+    void push(size_t self, Task &&task);
+    bool pop(size_t self, Task &task);
+    bool steal(size_t self, Task &task);
+    bool visit(dev_t device, ino_t inode);
+    void addFile(const QString &path, QMimeDatabase &mimeDatabase, Buffer &buffer) const;
+    void addFile(const std::shared_ptr<const Dir> &dir, const QString &dirPath, const QString &name,
+                 QMimeDatabase &mimeDatabase, Buffer &buffer) const;
+    bool ignored(const QString &name, const std::vector<QRegExp> &ignores) const;
+    std::vector<QRegExp> ignores(const QByteArray &ignoreFile) const;
+
+    static const size_t VISITED_SHARDS = 64;
+    static const size_t PROGRESS_INTERVAL = 256;
+
+    const Options options_;
+    const std::atomic<bool> &abort_;
+    const MimeClassifier &classifier_;
+    std::function<void(const QString&)> watch_;
+    std::function<void(const QString&)> progress_;
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<Buffer> buffers_;
+    std::atomic<size_t> pending_; // The dirs queued or being scanned
+    std::atomic<size_t> queued_;  // The dirs queued
+    std::atomic<size_t> scanned_;
+
+    // Idle threads wait for dirs to be queued or the crawl to end
+    QMutex idleMutex_;
+    QWaitCondition idle_;
+
+    // The (device, inode) of the crawled dirs, against loops
+    struct Shard {
+        QMutex mutex;
+        std::set<std::pair<dev_t, ino_t>> dirs;
+    };
+    std::unique_ptr<Shard[]> visited_;
+
+    const uint16_t dirMimeId_;
+
+    std::vector<std::shared_ptr<File>> files_;
+    std::set<QString> dirs_;
+
+};
+}
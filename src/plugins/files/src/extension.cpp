@@ -18,14 +18,16 @@
 #include <QSettings>
 #include <QStandardPaths>
 #include <QMessageBox>
-#include <QThreadPool>
 #include <QDir>
+#include <algorithm>
 #include <memory>
 #include "extension.h"
 #include "configwidget.h"
 #include "indexer.h"
+#include "indexcache.h"
 #include "file.h"
 #include "abstractquery.h"
+#include "backgroundpool.h"
 
 const char* Files::Extension::CFG_PATHS           = "paths";
 const char* Files::Extension::CFG_FUZZY           = "fuzzy";
@@ -47,6 +49,7 @@ const bool  Files::Extension::DEF_FOLLOW_SYMLINKS = false;
 const char* Files::Extension::CFG_SCAN_INTERVAL   = "scan_interval";
 const uint  Files::Extension::DEF_SCAN_INTERVAL   = 60;
 const char* Files::Extension::IGNOREFILE          = ".albertignore";
+const size_t Files::Extension::MAX_MATCHES        = 100;
 
 
 /** ***************************************************************************/
@@ -69,30 +72,36 @@ Files::Extension::Extension() : AbstractExtension("org.albert.extension.files")
         restorePaths();
     s.endGroup();
 
-    // Deserialize data
-    QFile dataFile(QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).
-                   filePath(QString("%1.dat").arg(id)));
-    if (dataFile.exists()) {
-        if (dataFile.open(QIODevice::ReadOnly| QIODevice::Text)) {
-            qDebug("[%s] Deserializing from %s", id.toUtf8().constData(), dataFile.fileName().toLocal8Bit().data());
-            QDataStream in(&dataFile);
-            quint64 count;
-            for (in >> count ;count != 0; --count){
-                shared_ptr<File> file = std::make_shared<File>();
-                file->deserialize(in);
-                index_.push_back(file);
-            }
-            dataFile.close();
-
-            // Build the offline index
-            for (const auto &item : index_)
-                offlineIndex_.add(item);
-        } else
-            qWarning() << "Could not open file: " << dataFile.fileName();
+    // Load the saved index
+    if (IndexCache::load(dataFilePath(), index_)) {
+        qDebug("[%s] Loaded %d files from %s", id.toUtf8().constData(), static_cast<int>(index_.size()),
+               dataFilePath().toLocal8Bit().constData());
+
+        // The updates of changed paths rely on the order by path. The data
+        // file is saved sorted, unless it was written by an older version.
+        auto pathLess = [](const shared_ptr<File> &lhs, const shared_ptr<File> &rhs){
+            return File::comparePaths(*lhs, *rhs) < 0;
+        };
+        const bool sorted = std::is_sorted(index_.begin(), index_.end(), pathLess);
+        if (!sorted)
+            std::sort(index_.begin(), index_.end(), pathLess);
+
+        // Map the saved offline index, rebuild it if it is outdated. It refers
+        // to the files by their position in the data file, sorting moved them.
+        vector<shared_ptr<IIndexable>> indexables(index_.begin(), index_.end());
+        if (!sorted || !offlineIndex_.load(indexFilePath(), indexables))
+            offlineIndex_.applyDelta(indexables, {});
     }
 
-    // Minute tick timer
-    connect(&indexIntervalTimer_, &QTimer::timeout, this, &Extension::updateIndex);
+    // Minute tick timer. Rescan only if the watcher misses changes.
+    connect(&indexIntervalTimer_, &QTimer::timeout, [this](){
+        if (!watcher_.isComplete())
+            updateIndex();
+    });
+
+    // Update the changed paths, rescan everything if changes got lost
+    connect(&watcher_, &FileWatcher::changed, this, &Extension::updatePaths);
+    connect(&watcher_, &FileWatcher::overflow, this, &Extension::updateIndex);
 
     // If the root dirs change write it to the settings
     connect(this, &Extension::rootDirsChanged, [this](const QStringList& dirs){
@@ -123,18 +132,63 @@ Files::Extension::~Extension() {
         loop.exec();
     }
 
-    // Serialize data
-    QFile dataFile(QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).
-                   filePath(QString("%1.dat").arg(id)));
-    if (dataFile.open(QIODevice::ReadWrite| QIODevice::Text)) {
-        qDebug("[%s] Serializing to %s", id.toUtf8().constData(), dataFile.fileName().toLocal8Bit().data());
-        QDataStream out( &dataFile );
-        out	<< static_cast<quint64>(index_.size());
-        for (const auto &item : index_)
-            item->serialize(out);
-        dataFile.close();
-    } else
-        qCritical() << "Could not write to " << dataFile.fileName();
+    // Save the index. Drop the saved offline index first, it refers to the
+    // items by their position in the data file.
+    QFile::remove(indexFilePath());
+    if (IndexCache::save(dataFilePath(), index_)) {
+        qDebug("[%s] Saved %d files to %s", id.toUtf8().constData(), static_cast<int>(index_.size()),
+               dataFilePath().toLocal8Bit().constData());
+
+        // Save the offline index in the order of the data file
+        offlineIndex_.save(indexFilePath(), vector<shared_ptr<IIndexable>>(index_.begin(), index_.end()));
+    }
+}
+
+
+
+/** ***************************************************************************/
+void Files::Extension::updatePaths(const QStringList &paths) {
+    // A changed ignore file changes what is indexed in its dir, rescan it
+    for (const QString &path : paths) {
+        const int slash = path.lastIndexOf('/');
+        if (slash > 0 && path.midRef(slash + 1) == QLatin1String(IGNOREFILE))
+            pendingPaths_.insert(path.left(slash));
+        else
+            pendingPaths_.insert(path);
+    }
+    updatePending();
+}
+
+
+
+/** ***************************************************************************/
+void Files::Extension::updatePending() {
+    // One indexer at a time, the paths wait for the running one
+    if (pendingPaths_.empty() || !indexer_.isNull())
+        return;
+    QStringList paths;
+    for (const QString &path : pendingPaths_)
+        paths.push_back(path);
+    pendingPaths_.clear();
+    indexer_ = new Indexer(this, paths);
+    connect(indexer_.data(), &Indexer::destroyed, this, &Extension::updatePending, Qt::QueuedConnection);
+    BackgroundPool::start(indexer_);
+}
+
+
+
+/** ***************************************************************************/
+QString Files::Extension::dataFilePath() const {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).
+            filePath(QString("%1.dat").arg(id));
+}
+
+
+
+/** ***************************************************************************/
+QString Files::Extension::indexFilePath() const {
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).
+            filePath(QString("%1.idx").arg(id));
 }
 
 
@@ -198,18 +252,32 @@ QWidget *Files::Extension::widget(QWidget *parent) {
 void Files::Extension::handleQuery(AbstractQuery * query) {
 
     // Skip  short terms since they pollute the output
-    if ( query->searchTerm().size() < 3)
+    if ( query->searchTerm().size() < 3 || query->token().stopRequested() )
         return;
 
-    // Search for matches. Lock memory against indexer
-    indexAccess_.lock();
-    vector<shared_ptr<IIndexable>> indexables = offlineIndex_.search(query->searchTerm().toLower());
-    indexAccess_.unlock();
+    // Search for the best matches. The index publishes snapshots, no locking
+    // needed. The search stops early if the query gets stale.
+    vector<std::pair<shared_ptr<IIndexable>,short>> indexables = offlineIndex_.search(query->searchTerm().toLower(), MAX_MATCHES, &query->token(), query->session());
 
     // Add results to query-> This cast is safe since index holds files only
-    for (shared_ptr<IIndexable> obj : indexables)
-        // TODO `Search` has to determine the relevance. Set to 0 for now
-        query->addMatch(std::static_pointer_cast<File>(obj), 0);
+    for (const std::pair<shared_ptr<IIndexable>,short> &obj : indexables)
+        query->addMatch(std::static_pointer_cast<File>(obj.first), obj.second);
+}
+
+
+
+/** ***************************************************************************/
+void Files::Extension::handleQueryMore(AbstractQuery * query) {
+
+    if (!query->isValid())
+        return;
+
+    // Continue the search of the query on the snapshot it ran on. Nothing if
+    // the session searched something else meanwhile.
+    vector<std::pair<shared_ptr<IIndexable>,short>> indexables = offlineIndex_.searchMore(query->searchTerm().toLower(), MAX_MATCHES, query->session());
+
+    for (const std::pair<shared_ptr<IIndexable>,short> &obj : indexables)
+        query->addMatch(std::static_pointer_cast<File>(obj.first), obj.second);
 }
 
 
@@ -294,13 +362,15 @@ void Files::Extension::updateIndex() {
         indexer_->abort();
         if (!widget_.isNull())
             widget_->ui.label_info->setText("Waiting for indexer to shut down ...");
-        connect(indexer_.data(), &Indexer::destroyed, this, &Extension::updateIndex, Qt::QueuedConnection);
+        connect(indexer_.data(), &Indexer::destroyed, this, &Extension::updateIndex, static_cast<Qt::ConnectionType>(Qt::QueuedConnection | Qt::UniqueConnection));
     } else {
-        // Create a new scanning runnable for the threadpool
+        // Create a new scanning runnable for the threadpool. Changes reported
+        // meanwhile are updated afterwards.
         indexer_ = new Indexer(this);
+        connect(indexer_.data(), &Indexer::destroyed, this, &Extension::updatePending, Qt::QueuedConnection);
 
         //  Run it
-        QThreadPool::globalInstance()->start(indexer_);
+        BackgroundPool::start(indexer_);
 
         // Restart the timer (Index update may have been started manually)
         if (indexIntervalTimer_.interval() != 0)
@@ -380,8 +450,6 @@ void Files::Extension::setScanInterval(uint minutes) {
 
 /** ***************************************************************************/
 void Files::Extension::setFuzzy(bool b) {
-    indexAccess_.lock();
     QSettings(qApp->applicationName()).setValue(QString("%1/%2").arg(id, CFG_FUZZY), b);
     offlineIndex_.setFuzzy(b);
-    indexAccess_.unlock();
 }
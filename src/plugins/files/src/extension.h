@@ -23,11 +23,13 @@
 
 #include <vector>
 #include <memory>
+#include <set>
 using std::vector;
 using std::shared_ptr;
 
 #include "abstractextension.h"
 #include "offlineindex.h"
+#include "filewatcher.h"
 
 namespace Files {
 
@@ -54,6 +56,7 @@ public:
     QString name() const override { return "Files"; }
     QWidget *widget(QWidget *parent = nullptr) override;
     void handleQuery(AbstractQuery * query) override;
+    void handleQueryMore(AbstractQuery * query) override;
 
     /*
      * Extension specific members
@@ -93,6 +96,11 @@ public:
     void setFuzzy(bool b = true);
 
 private:
+    QString dataFilePath() const;
+    QString indexFilePath() const;
+    void updatePaths(const QStringList &paths);
+    void updatePending();
+
     QPointer<ConfigWidget> widget_;
     vector<shared_ptr<File>> index_;
     OfflineIndex offlineIndex_;
@@ -100,6 +108,10 @@ private:
     QPointer<Indexer> indexer_;
     QTimer indexIntervalTimer_;
 
+    // Reports the changes in the indexed dirs, rescans are a fallback only
+    FileWatcher watcher_;
+    std::set<QString> pendingPaths_;
+
     // Index Properties
     QStringList rootDirs_;
     bool indexAudio_;
@@ -131,6 +143,7 @@ private:
     static const char* CFG_SCAN_INTERVAL;
     static const uint  DEF_SCAN_INTERVAL;
     static const char* IGNOREFILE;
+    static const size_t MAX_MATCHES;
 
 signals:
     void rootDirsChanged(const QStringList&);
@@ -15,25 +15,188 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QApplication>
-#include <QFileInfo>
-#include <QDataStream>
+#include <QDebug>
 #include <QMimeDatabase>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
 #include "file.h"
 #include "fileactions.h"
 #include "xdgiconlookup.h"
 
+namespace {
+
+// The mimetypes of the files, referred to by index. Few, never shrinks.
+struct MimeTable {
+    QMutex mutex;
+    std::vector<QString> names{QString()};
+    std::vector<QMimeType> mimetypes{QMimeType()};
+    std::map<QString, uint16_t> ids{{QString(), 0}};
+};
+
+MimeTable &mimeTable() {
+    static MimeTable table;
+    return table;
+}
+
+// Yields the characters of the segments joined by '/', -1 at the end
+class PathCursor final
+{
+public:
+    PathCursor(const QString *const *begin, const QString *const *end)
+        : segment_(begin), end_(end), pos_(0) {}
+
+    int next() {
+        if (segment_ == end_)
+            return -1;
+        if (pos_ < (*segment_)->size())
+            return (*segment_)->at(pos_++).unicode();
+        if (++segment_ == end_)
+            return -1;
+        pos_ = 0;
+        return '/';
+    }
+
+private:
+    const QString *const *segment_;
+    const QString *const *end_;
+    int pos_;
+};
+
+// Collects the names of the dirs from the root down and the name of the file
+void segments(const Files::File &file, std::vector<const Files::Dir*> &dirs, std::vector<const QString*> &names) {
+    dirs.clear();
+    for (const Files::Dir *dir = file.dir().get(); dir; dir = dir->parent().get())
+        dirs.push_back(dir);
+    std::reverse(dirs.begin(), dirs.end());
+    names.clear();
+    for (const Files::Dir *dir : dirs)
+        names.push_back(&dir->name());
+    names.push_back(&file.name());
+}
+
+}
+
 std::map<QString, Files::File::CacheEntry> Files::File::iconCache_;
 
 /** ***************************************************************************/
-QString Files::File::text() const {
-    return QFileInfo(path_).fileName();
+shared_ptr<const Files::Dir> Files::Dir::fromPath(const QString &path) {
+    shared_ptr<const Dir> dir = std::make_shared<const Dir>(nullptr, QString());
+    for (const QString &name : path.split('/', QString::SkipEmptyParts))
+        dir = std::make_shared<const Dir>(dir, name);
+    return dir;
+}
+
+
+
+/** ***************************************************************************/
+QString Files::Dir::path() const {
+    std::vector<const Dir*> dirs;
+    int size = 0;
+    for (const Dir *dir = this; dir; dir = dir->parent_.get()) {
+        dirs.push_back(dir);
+        size += dir->name_.size() + 1;
+    }
+    QString path;
+    path.reserve(size);
+    for (std::vector<const Dir*>::const_reverse_iterator it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        if (it != dirs.rbegin())
+            path.append('/');
+        path.append((*it)->name_);
+    }
+    return path;
+}
+
+
+
+/** ***************************************************************************/
+Files::File::File(const QString &path, const QString &mimeName)
+    : name_(path.mid(path.lastIndexOf('/') + 1)), mimeId_(internMimeName(mimeName)) {
+    const int slash = path.lastIndexOf('/');
+    dir_ = Dir::fromPath(slash > 0 ? path.left(slash) : QString());
+}
+
+
+
+/** ***************************************************************************/
+QString Files::File::path() const {
+    QString path = dir_->path();
+    path.reserve(path.size() + 1 + name_.size());
+    return path.append('/').append(name_);
 }
 
 
 
 /** ***************************************************************************/
 QString Files::File::subtext() const {
-    return path_;
+    return path();
+}
+
+
+
+/** ***************************************************************************/
+QString Files::File::mimeName() const {
+    MimeTable &table = mimeTable();
+    QMutexLocker locker(&table.mutex);
+    return table.names[mimeId_];
+}
+
+
+
+/** ***************************************************************************/
+QMimeType Files::File::mimetype() const {
+    MimeTable &table = mimeTable();
+    QMutexLocker locker(&table.mutex);
+    QMimeType &mimetype = table.mimetypes[mimeId_];
+    if (!mimetype.isValid())
+        mimetype = QMimeDatabase().mimeTypeForName(table.names[mimeId_]);
+    return mimetype;
+}
+
+
+
+/** ***************************************************************************/
+int Files::File::comparePaths(const File &lhs, const File &rhs) {
+    if (lhs.dir_ == rhs.dir_)
+        return QString::compare(lhs.name_, rhs.name_);
+
+    // Skip the dirs both paths share, compare the rest char by char
+    static thread_local std::vector<const Dir*> lhsDirs, rhsDirs;
+    static thread_local std::vector<const QString*> lhsNames, rhsNames;
+    segments(lhs, lhsDirs, lhsNames);
+    segments(rhs, rhsDirs, rhsNames);
+    size_t common = 0;
+    while (common < lhsDirs.size() && common < rhsDirs.size() && lhsDirs[common] == rhsDirs[common])
+        ++common;
+    PathCursor l(lhsNames.data() + common, lhsNames.data() + lhsNames.size());
+    PathCursor r(rhsNames.data() + common, rhsNames.data() + rhsNames.size());
+    for (;;) {
+        const int a = l.next(), b = r.next();
+        if (a != b)
+            return a < b ? -1 : 1;
+        if (a == -1)
+            return 0;
+    }
+}
+
+
+
+/** ***************************************************************************/
+uint16_t Files::File::internMimeName(const QString &mimeName) {
+    MimeTable &table = mimeTable();
+    QMutexLocker locker(&table.mutex);
+    std::map<QString, uint16_t>::const_iterator it = table.ids.find(mimeName);
+    if (it != table.ids.end())
+        return it->second;
+    if (table.names.size() > UINT16_MAX) {
+        qWarning() << "Too many mimetypes, dropping" << mimeName;
+        return 0;
+    }
+    const uint16_t id = static_cast<uint16_t>(table.names.size());
+    table.names.push_back(mimeName);
+    table.mimetypes.push_back(QMimeType());
+    table.ids.emplace(mimeName, id);
+    return id;
 }
 
 
@@ -41,7 +204,8 @@ QString Files::File::subtext() const {
 /** ***************************************************************************/
 QString Files::File::iconPath() const {
 
-    const QString xdgIconName = mimetype_.iconName();
+    const QMimeType mimetype = this->mimetype();
+    const QString xdgIconName = mimetype.iconName();
     CacheEntry ce;
 
     // First check if icon, not older than 15 minutes, exists
@@ -53,7 +217,7 @@ QString Files::File::iconPath() const {
 
     QString iconPath;
     if ( !(iconPath = XdgIconLookup::instance()->themeIconPath(xdgIconName)).isNull()  // Lookup iconName
-         || !(iconPath = XdgIconLookup::instance()->themeIconPath(mimetype_.genericIconName())).isNull()  // Lookup genericIconName
+         || !(iconPath = XdgIconLookup::instance()->themeIconPath(mimetype.genericIconName())).isNull()  // Lookup genericIconName
          || !(iconPath = XdgIconLookup::instance()->themeIconPath("unknown")).isNull()) {  // Lookup "unknown"
         ce = {iconPath, std::chrono::system_clock::now()};
         iconCache_.emplace(xdgIconName, ce);
@@ -80,25 +244,7 @@ vector<SharedAction> Files::File::actions() {
 /** ***************************************************************************/
 vector<IIndexable::WeightedKeyword> Files::File::indexKeywords() const {
     std::vector<IIndexable::WeightedKeyword> res;
-    res.emplace_back(QFileInfo(path_).fileName(), USHRT_MAX);
+    res.emplace_back(name_, USHRT_MAX);
     // TODO ADD PATH
     return res;
 }
-
-
-
-/** ***************************************************************************/
-void Files::File::serialize(QDataStream &out) {
-    out << path_
-        << mimetype_.name();
-}
-
-
-
-/** ***************************************************************************/
-void Files::File::deserialize(QDataStream &in) {
-    QMimeDatabase db;
-    QString mimetype;
-    in >> path_ >> mimetype;
-    mimetype_ = db.mimeTypeForName(mimetype);
-}
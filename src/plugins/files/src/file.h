@@ -16,6 +16,8 @@
 
 #pragma once
 #include <QMimeType>
+#include <QString>
+#include <cstdint>
 #include <map>
 #include <vector>
 #include <chrono>
@@ -30,6 +32,36 @@ class AbstractAction;
 
 namespace Files {
 
+/**
+ * @brief The Dir class
+ * A node of the tree of the indexed dirs. Shared by the files and the subdirs
+ * in the dir, its path is built on demand only. The root has no parent and an
+ * empty name. Immutable.
+ */
+class Dir final
+{
+public:
+
+    Dir(shared_ptr<const Dir> parent, const QString &name)
+        : parent_(parent), name_(name) {}
+
+    /** Returns a chain of new nodes for the absolute path of a dir */
+    static shared_ptr<const Dir> fromPath(const QString &path);
+
+    /** Return the path of the dir, the root being "" */
+    QString path() const;
+
+    const shared_ptr<const Dir> &parent() const { return parent_; }
+    const QString &name() const { return name_; }
+
+private:
+
+    const shared_ptr<const Dir> parent_;
+    const QString name_;
+
+};
+
+
 class File final : public AbstractItem, public IIndexable
 {
     struct OpenFileAction;
@@ -39,16 +71,16 @@ class File final : public AbstractItem, public IIndexable
 
 public:
 
-    File() {}
-    File(QString path, QMimeType mimetype)
-        : path_(path), mimetype_(mimetype){}
+    File(const QString &path, const QString &mimeName);
+    File(shared_ptr<const Dir> dir, const QString &name, uint16_t mimeId)
+        : dir_(dir), name_(name), mimeId_(mimeId) {}
 
     /*
      * Implementation of Item interface
      */
 
-    QString id() const override { return path_; }
-    QString text() const override;
+    QString id() const override { return path(); }
+    QString text() const override { return name_; }
     QString subtext() const override;
     QString iconPath() const override;
     vector<IIndexable::WeightedKeyword> indexKeywords() const override;
@@ -58,22 +90,36 @@ public:
      * Item specific members
      */
 
-    /** Return the path of the file */
-    const QString &path() const { return path_; }
+    /** Return the path of the file, built on each call */
+    QString path() const;
+
+    /** Return the dir of the file */
+    const shared_ptr<const Dir> &dir() const { return dir_; }
 
-    /** Return the mimetype of the file */
-    const QMimeType &mimetype() const { return mimetype_; }
+    /** Return the name of the file */
+    const QString &name() const { return name_; }
 
-    /** Serialize the desktop entry */
-    void serialize(QDataStream &out);
+    /** Return the id of the mimetype of the file, equal ids mean equal mimetypes */
+    uint16_t mimeId() const { return mimeId_; }
 
-    /** Deserialize the desktop entry */
-    void deserialize(QDataStream &in);
+    /** Return the name of the mimetype of the file */
+    QString mimeName() const;
+
+    /** Return the mimetype of the file, resolved on first use */
+    QMimeType mimetype() const;
+
+    /** Compares the paths of the files like QString::compare, without building them */
+    static int comparePaths(const File &lhs, const File &rhs);
+
+    /** Returns the id of the mimetype with the given name. Thread safe. */
+    static uint16_t internMimeName(const QString &mimeName);
 
 private:
 
-    QString path_;
-    QMimeType mimetype_;
+    shared_ptr<const Dir> dir_;
+    QString name_;
+    uint16_t mimeId_;
+
     struct CacheEntry {
         QString path;
         system_clock::time_point ctime;
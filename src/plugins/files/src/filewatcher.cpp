@@ -0,0 +1,215 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QDebug>
+#include <QSocketNotifier>
+#include <cerrno>
+#include <cstring>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include "filewatcher.h"
+
+namespace {
+const uint32_t EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+                      | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+}
+
+
+
+/** ***************************************************************************/
+Files::FileWatcher::FileWatcher(QObject *parent)
+    : QObject(parent), notifier_(nullptr), complete_(true), rescanComplete_(true), limitWarned_(false) {
+    fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        qWarning() << "[Files] Unable to watch the files:" << std::strerror(errno);
+        complete_ = false;
+        return;
+    }
+    notifier_ = new QSocketNotifier(fd_, QSocketNotifier::Read, this);
+    connect(notifier_, &QSocketNotifier::activated, this, &FileWatcher::readEvents);
+
+    // Report the first event of a burst delayed, the rest comes along
+    coalesceTimer_.setInterval(COALESCE_INTERVAL);
+    coalesceTimer_.setSingleShot(true);
+    connect(&coalesceTimer_, &QTimer::timeout, this, &FileWatcher::reportChanges);
+}
+
+
+
+/** ***************************************************************************/
+Files::FileWatcher::~FileWatcher() {
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::watch(const QString &dir) {
+    QMutexLocker locker(&mutex_);
+    addWatch(dir);
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::beginRescan() {
+    rescanComplete_ = true;
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::synchronize(const std::set<QString> &dirs) {
+    QMutexLocker locker(&mutex_);
+    if (fd_ < 0)
+        return;
+
+    // Drop the watches of the dirs not watched anymore
+    for (std::map<QString, int>::iterator it = watches_.begin(); it != watches_.end();) {
+        if (dirs.count(it->first)) {
+            ++it;
+            continue;
+        }
+        inotify_rm_watch(fd_, it->second);
+        dirs_.erase(it->second);
+        it = watches_.erase(it);
+    }
+
+    // The dirs are rescanned, everything is known again if they were watched
+    // all along
+    for (const QString &dir : dirs)
+        addWatch(dir);
+    complete_ = rescanComplete_.load();
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::addWatch(const QString &dir) {
+    // Called locked
+    if (fd_ < 0 || watches_.count(dir))
+        return;
+    const int wd = inotify_add_watch(fd_, dir.toLocal8Bit().constData(), EVENTS);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            complete_ = false;
+            rescanComplete_ = false;
+            if (!limitWarned_)
+                qWarning() << "[Files] The inotify watch limit is reached, falling back to rescans."
+                           << "Raise fs.inotify.max_user_watches to watch all dirs.";
+            limitWarned_ = true;
+        }
+        return;
+    }
+
+    // The same inode yields the same descriptor, e.g. for a moved dir
+    std::map<int, QString>::iterator it = dirs_.find(wd);
+    if (it != dirs_.end())
+        watches_.erase(it->second);
+    dirs_[wd] = dir;
+    watches_[dir] = wd;
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::removeWatches(const QString &path) {
+    // Called locked. Drops the watches of the path and the dirs below.
+    const QString prefix = path + '/';
+    for (std::map<QString, int>::iterator it = watches_.lower_bound(path);
+         it != watches_.end() && (it->first == path || it->first.startsWith(prefix));) {
+        inotify_rm_watch(fd_, it->second);
+        dirs_.erase(it->second);
+        it = watches_.erase(it);
+    }
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::readEvents() {
+    alignas(inotify_event) char buffer[64 * 1024];
+    bool lost = false;
+    QMutexLocker locker(&mutex_);
+    for (;;) {
+        const ssize_t size = ::read(fd_, buffer, sizeof(buffer));
+        if (size <= 0)
+            break;
+        for (const char *p = buffer; p < buffer + size;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            // The kernel dropped events, only a rescan helps
+            if (event->mask & IN_Q_OVERFLOW) {
+                complete_ = false;
+                rescanComplete_ = false;
+                lost = true;
+                continue;
+            }
+
+            std::map<int, QString>::iterator it = dirs_.find(event->wd);
+            if (it == dirs_.end())
+                continue;
+
+            // The watch is gone, e.g. the dir was deleted
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(it->second);
+                dirs_.erase(it);
+                continue;
+            }
+
+            const QString path = (event->len == 0)
+                    ? it->second
+                    : it->second + '/' + QString::fromLocal8Bit(event->name);
+
+            // The watches below a moved dir would report the old paths
+            if ((event->mask & IN_MOVED_FROM) && (event->mask & IN_ISDIR))
+                removeWatches(path);
+
+            changed_.insert(path);
+        }
+    }
+    if (!changed_.empty() && !coalesceTimer_.isActive())
+        coalesceTimer_.start();
+    locker.unlock();
+    if (lost)
+        emit overflow();
+}
+
+
+
+/** ***************************************************************************/
+void Files::FileWatcher::reportChanges() {
+    // Drop the paths below reported ones, they are rescanned anyway. The
+    // ancestors of a path precede it.
+    std::set<QString> reported;
+    QStringList paths;
+    {
+        QMutexLocker locker(&mutex_);
+        for (const QString &path : changed_) {
+            bool below = false;
+            for (int i = path.indexOf('/', 1); i > 0 && !below; i = path.indexOf('/', i + 1))
+                below = reported.count(path.left(i)) != 0;
+            if (!below) {
+                reported.insert(path);
+                paths.push_back(path);
+            }
+        }
+        changed_.clear();
+    }
+    emit changed(paths);
+}
@@ -0,0 +1,96 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QObject>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
+#include <map>
+#include <set>
+class QSocketNotifier;
+
+namespace Files {
+
+/**
+ * @brief The FileWatcher class
+ * Watches directories by inotify and reports the paths that changed in them.
+ * The events of a burst are coalesced, a path is reported once. If the watch
+ * limit is hit or events got lost the watcher is incomplete, the watched
+ * dirs have to be rescanned then. The watches can be set from any thread,
+ * the changes are reported in the thread of the watcher. Scanners watch a dir
+ * before reading it, changes during the scan are reported afterwards.
+ */
+class FileWatcher final : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    explicit FileWatcher(QObject *parent = nullptr);
+    ~FileWatcher();
+
+    /** Watches the dir in addition to the watched ones */
+    void watch(const QString &dir);
+
+    /** Starts a rescan of all dirs, the dirs are watched while scanned */
+    void beginRescan();
+
+    /**
+     * Watches exactly the dirs, i.e. drops the other watches. Completes the
+     * rescan, unless a watch failed or events got lost since it began.
+     */
+    void synchronize(const std::set<QString> &dirs);
+
+    /** True if all dirs passed are watched and no event got lost since */
+    bool isComplete() const { return complete_; }
+
+private:
+
+    void readEvents();
+    void addWatch(const QString &dir);
+    void removeWatches(const QString &path);
+    void reportChanges();
+
+    static const int COALESCE_INTERVAL = 300;
+
+    int fd_;
+    QSocketNotifier *notifier_;
+    QTimer coalesceTimer_;
+    std::atomic<bool> complete_;
+    std::atomic<bool> rescanComplete_; // No watch failed, no event got lost since beginRescan
+    bool limitWarned_;
+
+    // The watched dirs by watch descriptor and vice versa
+    QMutex mutex_;
+    std::map<int, QString> dirs_;
+    std::map<QString, int> watches_;
+
+    // The paths changed since the last report
+    std::set<QString> changed_;
+
+signals:
+
+    /** The paths changed, sorted, none below another one */
+    void changed(const QStringList &paths);
+
+    /** Events got lost, the watched dirs have to be rescanned */
+    void overflow();
+
+};
+}
@@ -0,0 +1,272 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include "indexcache.h"
+#include "file.h"
+
+namespace {
+
+// The header of the cache file, followed by the dirs, the mimetypes, the
+// files and the arena of names as UTF-16. All sections are 8 byte aligned.
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t dirs;
+    uint64_t mimetypes;
+    uint64_t files;
+    uint64_t arenaSize; // In UTF-16 code units
+    uint64_t checksum;
+    uint64_t reserved;
+};
+
+// The root dir is the first one, its name is empty and it has no parent
+struct DirRecord {
+    uint32_t parent;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+};
+
+struct MimeRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+};
+
+struct FileRecord {
+    uint32_t dir;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t mimetype;
+};
+
+const char MAGIC[8] = {'A', 'L', 'B', 'E', 'R', 'T', 'F', 'I'};
+const uint32_t VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint32_t NO_PARENT = 0xFFFFFFFF;
+
+// FNV-1a style over 8 byte words, the sizes of the sections are multiples of
+// 8. Unlike FNV-1a each step mixes the high bits back down, the multiplication
+// of a whole word carries into the higher bits only.
+uint64_t checksum(const char *data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3;
+        hash ^= hash >> 29;
+    }
+    return hash ^ size;
+}
+
+class Writer final
+{
+public:
+
+    Writer() {
+        dirIds_.emplace(QString(), 0);
+        dirs_.push_back(DirRecord{NO_PARENT, 0, 0, 0});
+    }
+
+    void add(const Files::File &file) {
+        FileRecord record;
+        record.dir = dir(*file.dir());
+        record.nameOffset = append(file.name(), record.nameLength);
+        std::map<uint16_t, uint32_t>::iterator it = mimeIds_.find(file.mimeId());
+        record.mimetype = (it != mimeIds_.end()) ? it->second : (mimeIds_[file.mimeId()] = mimetype(file.mimeName()));
+        files_.push_back(record);
+    }
+
+    QByteArray data() {
+        // Pad the arena to 8 bytes
+        while (arena_.size() % 4 != 0)
+            arena_.append(QChar());
+
+        QByteArray payload;
+        payload.append(reinterpret_cast<const char*>(dirs_.data()), static_cast<int>(dirs_.size() * sizeof(DirRecord)));
+        payload.append(reinterpret_cast<const char*>(mimetypes_.data()), static_cast<int>(mimetypes_.size() * sizeof(MimeRecord)));
+        payload.append(reinterpret_cast<const char*>(files_.data()), static_cast<int>(files_.size() * sizeof(FileRecord)));
+        payload.append(reinterpret_cast<const char*>(arena_.utf16()), arena_.size() * 2);
+
+        FileHeader header;
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.byteOrder = BYTE_ORDER_MARK;
+        header.dirs = dirs_.size();
+        header.mimetypes = mimetypes_.size();
+        header.files = files_.size();
+        header.arenaSize = static_cast<uint64_t>(arena_.size());
+        header.checksum = checksum(payload.constData(), static_cast<size_t>(payload.size()));
+        header.reserved = 0;
+        return QByteArray(reinterpret_cast<const char*>(&header), sizeof(header)) + payload;
+    }
+
+private:
+
+    // Returns the id of a node. Rescans create new nodes for the same dirs,
+    // they are merged by path.
+    uint32_t dir(const Files::Dir &node) {
+        std::map<const Files::Dir*, uint32_t>::iterator it = nodeIds_.find(&node);
+        if (it != nodeIds_.end())
+            return it->second;
+        return nodeIds_[&node] = dir(node.path());
+    }
+
+    // Returns the id of the dir at path, "" being the root dir
+    uint32_t dir(const QString &path) {
+        std::map<QString, uint32_t>::iterator it = dirIds_.find(path);
+        if (it != dirIds_.end())
+            return it->second;
+        const int slash = std::max(path.lastIndexOf('/'), 0);
+        DirRecord record;
+        record.parent = dir(path.left(slash));
+        record.nameOffset = append(path.mid(slash + 1), record.nameLength);
+        record.reserved = 0;
+        dirs_.push_back(record);
+        return dirIds_[path] = static_cast<uint32_t>(dirs_.size() - 1);
+    }
+
+    uint32_t mimetype(const QString &name) {
+        std::map<QString, uint32_t>::iterator it = mimetypeIds_.find(name);
+        if (it != mimetypeIds_.end())
+            return it->second;
+        MimeRecord record;
+        record.nameOffset = append(name, record.nameLength);
+        mimetypes_.push_back(record);
+        return mimetypeIds_[name] = static_cast<uint32_t>(mimetypes_.size() - 1);
+    }
+
+    uint32_t append(const QString &name, uint32_t &length) {
+        const uint32_t offset = static_cast<uint32_t>(arena_.size());
+        arena_.append(name);
+        length = static_cast<uint32_t>(name.size());
+        return offset;
+    }
+
+    std::map<const Files::Dir*, uint32_t> nodeIds_;
+    std::map<QString, uint32_t> dirIds_;
+    std::map<uint16_t, uint32_t> mimeIds_;
+    std::map<QString, uint32_t> mimetypeIds_;
+    std::vector<DirRecord> dirs_;
+    std::vector<MimeRecord> mimetypes_;
+    std::vector<FileRecord> files_;
+    QString arena_;
+
+};
+
+}
+
+
+
+/** ***************************************************************************/
+bool Files::IndexCache::save(const QString &path, const std::vector<std::shared_ptr<File>> &files) {
+    Writer writer;
+    for (const std::shared_ptr<File> &file : files)
+        writer.add(*file);
+    const QByteArray data = writer.data();
+
+    // Replace the file atomically
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "Could not write the file index to" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+
+
+/** ***************************************************************************/
+bool Files::IndexCache::load(const QString &path, std::vector<std::shared_ptr<File>> &files) {
+    // The mapping is released when the file is closed
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const qint64 size = file.size();
+    const char *data = (size >= static_cast<qint64>(sizeof(FileHeader)))
+            ? reinterpret_cast<const char*>(file.map(0, size)) : nullptr;
+    if (!data) {
+        qWarning() << "Could not map the file index" << path;
+        return false;
+    }
+
+    // Check the header and the payload
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const char *payload = data + sizeof(header);
+    const uint64_t payloadSize = static_cast<uint64_t>(size) - sizeof(header);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != VERSION
+            || header.byteOrder != BYTE_ORDER_MARK
+            || header.dirs == 0 || header.dirs >= NO_PARENT
+            || header.mimetypes >= NO_PARENT
+            || header.files > payloadSize / sizeof(FileRecord)
+            || header.arenaSize > payloadSize / 2
+            || payloadSize != header.dirs * sizeof(DirRecord) + header.mimetypes * sizeof(MimeRecord)
+                              + header.files * sizeof(FileRecord) + header.arenaSize * 2
+            || header.checksum != checksum(payload, static_cast<size_t>(payloadSize))) {
+        qWarning() << "Discarding the outdated or corrupt file index" << path;
+        return false;
+    }
+    const DirRecord *dirRecords = reinterpret_cast<const DirRecord*>(payload);
+    const MimeRecord *mimeRecords = reinterpret_cast<const MimeRecord*>(dirRecords + header.dirs);
+    const FileRecord *fileRecords = reinterpret_cast<const FileRecord*>(mimeRecords + header.mimetypes);
+    const QChar *arena = reinterpret_cast<const QChar*>(fileRecords + header.files);
+
+    // Do not trust the records either
+    auto inArena = [&header](uint32_t offset, uint32_t length){
+        return static_cast<uint64_t>(offset) + length <= header.arenaSize;
+    };
+    bool valid = dirRecords[0].parent == NO_PARENT && dirRecords[0].nameLength == 0;
+    for (uint64_t i = 1; valid && i < header.dirs; ++i)
+        valid = dirRecords[i].parent < i && inArena(dirRecords[i].nameOffset, dirRecords[i].nameLength);
+    for (uint64_t i = 0; valid && i < header.mimetypes; ++i)
+        valid = inArena(mimeRecords[i].nameOffset, mimeRecords[i].nameLength);
+    for (uint64_t i = 0; valid && i < header.files; ++i)
+        valid = fileRecords[i].dir < header.dirs && fileRecords[i].mimetype < header.mimetypes
+                && inArena(fileRecords[i].nameOffset, fileRecords[i].nameLength);
+    if (!valid) {
+        qWarning() << "Discarding the malformed file index" << path;
+        return false;
+    }
+
+    // Build the tree of the dirs, the parents come first. Intern the mimetypes.
+    std::vector<std::shared_ptr<const Dir>> dirs(header.dirs);
+    dirs[0] = std::make_shared<const Dir>(nullptr, QString());
+    for (uint64_t i = 1; i < header.dirs; ++i)
+        dirs[i] = std::make_shared<const Dir>(dirs[dirRecords[i].parent],
+                QString(arena + dirRecords[i].nameOffset, static_cast<int>(dirRecords[i].nameLength)));
+    std::vector<uint16_t> mimeIds(header.mimetypes);
+    for (uint64_t i = 0; i < header.mimetypes; ++i)
+        mimeIds[i] = File::internMimeName(QString(arena + mimeRecords[i].nameOffset, static_cast<int>(mimeRecords[i].nameLength)));
+
+    std::vector<std::shared_ptr<File>> result;
+    result.reserve(header.files);
+    for (uint64_t i = 0; i < header.files; ++i) {
+        const FileRecord &record = fileRecords[i];
+        result.push_back(std::make_shared<File>(dirs[record.dir],
+                                                QString(arena + record.nameOffset, static_cast<int>(record.nameLength)),
+                                                mimeIds[record.mimetype]));
+    }
+    std::swap(files, result);
+    return true;
+}
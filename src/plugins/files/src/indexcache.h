@@ -0,0 +1,54 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QString>
+#include <memory>
+#include <vector>
+
+namespace Files {
+
+class File;
+
+/**
+ * @brief The IndexCache class
+ * Saves the file index in a compact binary file, mapped on load. The paths
+ * are stored as a tree of dirs, each file refers to its dir and its name. The
+ * names live in a string arena, the mimetype names in a table of their own.
+ * The file is versioned and checksummed.
+ */
+class IndexCache final
+{
+public:
+
+    /**
+     * @brief Save the files
+     * @param path The path of the cache file, replaced atomically
+     * @param files The files, in the order load returns them
+     * @return True on success
+     */
+    static bool save(const QString &path, const std::vector<std::shared_ptr<File>> &files);
+
+    /**
+     * @brief Load the files
+     * @param path The path of the cache file
+     * @param files Set to the saved files, unchanged on failure
+     * @return True on success, false if the file is missing, outdated or corrupt
+     */
+    static bool load(const QString &path, std::vector<std::shared_ptr<File>> &files);
+
+};
+}
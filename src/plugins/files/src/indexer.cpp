@@ -14,112 +14,132 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
-#include <QDirIterator>
 #include <QDebug>
+#include <QFileInfo>
 #include <QThread>
+#include <algorithm>
+#include <iterator>
 #include <map>
 #include <set>
 #include <functional>
+#include "backgroundpool.h"
 #include "indexer.h"
+#include "crawler.h"
 #include "file.h"
 #include "extension.h"
+#include "filewatcher.h"
+
+namespace {
+bool pathLess(const shared_ptr<Files::File> &lhs, const shared_ptr<Files::File> &rhs) {
+    return Files::File::comparePaths(*lhs, *rhs) < 0;
+}
+bool pathEqual(const shared_ptr<Files::File> &lhs, const shared_ptr<Files::File> &rhs) {
+    return Files::File::comparePaths(*lhs, *rhs) == 0;
+}
+}
 
 
 /** ***************************************************************************/
 void Files::Extension::Indexer::run() {
+    const bool full = paths_.isEmpty();
 
     // Notification
-    qDebug("[%s] Start indexing in background thread", extension_->id.toUtf8().constData());
-    emit statusInfo("Indexing files ...");
-
-    // Prepare the iterator properties
-    QDir::Filters filters = QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot;
-    if (extension_->indexHidden_)
-        filters |= QDir::Hidden;
-
-    // Get a new index
-    std::vector<shared_ptr<File>> newIndex;
-    std::set<QString> indexedDirs;
-
-
-    // Anonymous function that implemnents the index recursion
-    std::function<void(const QFileInfo&)> indexRecursion =
-            [this, &newIndex, &indexedDirs, &filters, &indexRecursion](const QFileInfo& fileInfo){
-        if (abort_) return;
-
-        const QString canonicalPath = fileInfo.canonicalFilePath();
-
-
-        if (fileInfo.isFile()) {
-
-            // If the file matches the index options, index it
-            QMimeType mimetype = mimeDatabase_.mimeTypeForFile(canonicalPath);
-            const QString mimeName = mimetype.name();
-            if ((extension_->indexAudio_ && mimeName.startsWith("audio"))
-                    ||(extension_->indexVideo_ && mimeName.startsWith("video"))
-                    ||(extension_->indexImage_ && mimeName.startsWith("image"))
-                    ||(extension_->indexDocs_ &&
-                       (mimeName.startsWith("application") || mimeName.startsWith("text")))) {
-                newIndex.push_back(std::make_shared<File>(canonicalPath, mimetype));
-            }
-        } else if (fileInfo.isDir()) {
-
-            emit statusInfo(QString("Indexing %1.").arg(canonicalPath));
-
-            // Skip if this dir has already been indexed
-            if (indexedDirs.find(canonicalPath)!=indexedDirs.end())
-                return;
+    if (full) {
+        qDebug("[%s] Start indexing in background thread", extension_->id.toUtf8().constData());
+        emit statusInfo("Indexing files ...");
+    }
 
-            // Remember that this dir has been indexed to avoid loops
-            indexedDirs.insert(canonicalPath);
+    // Crawl the roots, or the changed paths that are still there
+    Crawler::Options options;
+    options.indexAudio = extension_->indexAudio_;
+    options.indexVideo = extension_->indexVideo_;
+    options.indexImage = extension_->indexImage_;
+    options.indexDocs = extension_->indexDocs_;
+    options.indexDirs = extension_->indexDirs_;
+    options.indexHidden = extension_->indexHidden_;
+    options.followSymlinks = extension_->followSymlinks_;
+    options.ignoreFile = extension_->IGNOREFILE;
+    Crawler crawler(options, MimeClassifier::instance(), abort_);
+
+    QStringList paths;
+    if (full)
+        paths = extension_->rootDirs_;
+    else
+        for (const QString &path : paths_)
+            if (QFileInfo::exists(path) && !crawler.skip(path))
+                paths.push_back(path);
+
+    // A full scan uses the background pool, a few changed paths one thread
+    const size_t threads = (full) ? static_cast<size_t>(BackgroundPool::instance()->maxThreadCount()) : 1;
+    if (full)
+        extension_->watcher_.beginRescan();
+    crawler.crawl(paths, threads, [this](const QString &dir){
+        extension_->watcher_.watch(dir);
+    }, [this](const QString &dir){
+        emit statusInfo(QString("Indexing %1.").arg(dir));
+    });
+    if (abort_) return;
+
+    std::vector<shared_ptr<File>> &newIndex = crawler.files();
+    std::sort(newIndex.begin(), newIndex.end(), pathLess);
+    newIndex.erase(std::unique(newIndex.begin(), newIndex.end(), pathEqual), newIndex.end());
+
+
+    // Get the entries covered by the scan, all of them or the ones at and
+    // below the paths. The index is sorted by path.
+    const std::vector<shared_ptr<File>> &index = extension_->index_;
+    std::vector<shared_ptr<File>> oldIndex;
+    if (full) {
+        oldIndex = index;
+        std::sort(oldIndex.begin(), oldIndex.end(), pathLess);
+    } else {
+        for (const QString &path : paths_) {
+            const shared_ptr<File> key = std::make_shared<File>(path, QString());
+            std::vector<shared_ptr<File>>::const_iterator it = std::lower_bound(index.begin(), index.end(), key, pathLess);
+            if (it != index.end() && pathEqual(*it, key))
+                oldIndex.push_back(*it);
+            const QString prefixPath = path + '/';
+            const shared_ptr<File> prefix = std::make_shared<File>(prefixPath, QString());
+            for (it = std::lower_bound(index.begin(), index.end(), prefix, pathLess);
+                 it != index.end() && (*it)->path().startsWith(prefixPath); ++it)
+                oldIndex.push_back(*it);
+        }
+        std::sort(oldIndex.begin(), oldIndex.end(), pathLess);
+        oldIndex.erase(std::unique(oldIndex.begin(), oldIndex.end(), pathEqual), oldIndex.end());
+    }
 
-            // If the dir matches the index options, index it
-            if (extension_->indexDirs_) {
-                QMimeType mimetype = mimeDatabase_.mimeTypeForFile(canonicalPath);
-                newIndex.push_back(std::make_shared<File>(canonicalPath, mimetype));
-            }
 
-            // Ignore ignorefile by default
-            std::vector<QRegExp> ignores;
-            ignores.push_back(QRegExp(extension_->IGNOREFILE, Qt::CaseSensitive, QRegExp::Wildcard));
-
-            // Read the ignore file, see http://doc.qt.io/qt-5/qregexp.html#wildcard-matching
-            QFile file(QDir(canonicalPath).filePath(extension_->IGNOREFILE));
-            if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-                QTextStream in(&file);
-                while (!in.atEnd())
-                    ignores.push_back(QRegExp(in.readLine().trimmed(), Qt::CaseSensitive, QRegExp::Wildcard));
-                file.close();
-            }
-
-            // Index all children in the dir
-            QDirIterator dirIterator(canonicalPath, filters, QDirIterator::NoIteratorFlags);
-            while (dirIterator.hasNext()) {
-                dirIterator.next();
-                const QString & fileName = dirIterator.fileName();
-                const QFileInfo & fileInfo = dirIterator.fileInfo();
-
-                // Skip if this file matches one of the ignore patterns
-                for (const QRegExp& ignore : ignores)
-                    if(ignore.exactMatch(fileName))
-                        goto SKIP_THIS;
-
-                // Skip if this file is a symlink and we shoud skip symlinks
-                if (fileInfo.isSymLink() && !extension_->followSymlinks_)
-                    goto SKIP_THIS;
-
-                // Index this file
-                indexRecursion(fileInfo);
-                SKIP_THIS:;
+    // Compute the changes. Walk both indices sorted by path.
+    std::vector<shared_ptr<IIndexable>> added;
+    std::vector<shared_ptr<IIndexable>> removed;
+    std::vector<shared_ptr<File>>::iterator oldIt = oldIndex.begin();
+    for (shared_ptr<File> &file : newIndex) {
+        for (; oldIt != oldIndex.end() && pathLess(*oldIt, file); ++oldIt)
+            removed.push_back(*oldIt);
+        if (oldIt != oldIndex.end() && pathEqual(*oldIt, file)) {
+            // Keep unchanged files, the offline index refers to them
+            if ((*oldIt)->mimeId() == file->mimeId()) {
+                file = *oldIt++;
+                continue;
             }
+            removed.push_back(*oldIt++);
         }
-    };
-
-
-    // Start the indexing
-    for (const QString &rootDir : extension_->rootDirs_) {
-        indexRecursion(QFileInfo(rootDir));
-        if (abort_) return;
+        added.push_back(file);
+    }
+    removed.insert(removed.end(), oldIt, oldIndex.end());
+
+
+    // A partial scan replaces the covered entries only
+    if (!full) {
+        std::vector<shared_ptr<File>> kept;
+        kept.reserve(index.size() - oldIndex.size());
+        std::set_difference(index.begin(), index.end(), oldIndex.begin(), oldIndex.end(),
+                            std::back_inserter(kept), pathLess);
+        std::vector<shared_ptr<File>> merged;
+        merged.reserve(kept.size() + newIndex.size());
+        std::merge(kept.begin(), kept.end(), newIndex.begin(), newIndex.end(),
+                   std::back_inserter(merged), pathLess);
+        std::swap(newIndex, merged);
     }
 
 
@@ -137,12 +157,19 @@ void Files::Extension::Indexer::run() {
     // Set the new index (use swap to shift destruction out of critical area)
     std::swap(extension_->index_, newIndex);
 
-    // Rebuild the offline index
-    extension_->offlineIndex_.clear();
-    for (auto &item : extension_->index_)
-        extension_->offlineIndex_.add(item);
+    // Update the offline index
+    extension_->offlineIndex_.applyDelta(added, removed);
+
+    // The scanned dirs are watched, drop the watches of the others
+    if (full)
+        extension_->watcher_.synchronize(crawler.dirs());
 
     // Notification
-    qDebug("[%s] Indexing done (%d items)", extension_->id.toUtf8().constData(), static_cast<int>(extension_->index_.size()));
-    emit statusInfo(QString("Indexed %1 files").arg(extension_->index_.size()));
+    if (full) {
+        qDebug("[%s] Indexing done (%d items)", extension_->id.toUtf8().constData(), static_cast<int>(extension_->index_.size()));
+        emit statusInfo(QString("Indexed %1 files").arg(extension_->index_.size()));
+    } else {
+        qDebug("[%s] Updated %d paths (+%d -%d items)", extension_->id.toUtf8().constData(), paths_.size(),
+               static_cast<int>(added.size()), static_cast<int>(removed.size()));
+    }
 }
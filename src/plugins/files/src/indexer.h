@@ -17,8 +17,11 @@
 #pragma once
 #include <QObject>
 #include <QRunnable>
-#include <QMimeDatabase>
 #include <QMutex>
+#include <QStringList>
+#include <atomic>
+#include <set>
+#include <vector>
 #include "extension.h"
 
 namespace Files {
@@ -27,15 +30,19 @@ class Extension::Indexer final : public QObject, public QRunnable
 {
     Q_OBJECT
 public:
+    /** Rescans the root dirs */
     Indexer(Extension *ext)
         : extension_(ext), abort_(false) {}
+    /** Rescans the given paths and the files below only */
+    Indexer(Extension *ext, const QStringList &paths)
+        : extension_(ext), paths_(paths), abort_(false) {}
     void run() override;
     void abort(){abort_=true;}
 
 private:
     Extension *extension_;
-    QMimeDatabase mimeDatabase_;
-    bool abort_;
+    QStringList paths_;
+    std::atomic<bool> abort_;
 
 signals:
     void statusInfo(const QString&);
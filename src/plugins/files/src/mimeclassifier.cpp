@@ -0,0 +1,102 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <QMimeDatabase>
+#include <QMimeType>
+#include "mimeclassifier.h"
+
+
+
+/** ***************************************************************************/
+const Files::MimeClassifier &Files::MimeClassifier::instance() {
+    // Building the table takes a while, the mime database does not change
+    static const MimeClassifier classifier;
+    return classifier;
+}
+
+
+
+/** ***************************************************************************/
+Files::MimeClassifier::MimeClassifier() {
+    QMimeDatabase mimeDatabase;
+    for (const QMimeType &mimetype : mimeDatabase.allMimeTypes()) {
+        for (const QString &suffix : mimetype.suffixes()) {
+            if (suffixes_.count(suffix))
+                continue;
+
+            // Skip suffixes claimed by mimetypes of different categories,
+            // e.g. "ts" (video/mp2t, text/vnd.trolltech.linguist)
+            const QString fileName = "x." + suffix;
+            const QString mimeName = mimeDatabase.mimeTypeForFile(fileName, QMimeDatabase::MatchExtension).name();
+            const Category category = MimeClassifier::category(mimeName);
+            bool ambiguous = false;
+            for (const QMimeType &candidate : mimeDatabase.mimeTypesForFileName(fileName))
+                ambiguous |= MimeClassifier::category(candidate.name()) != category;
+            if (!ambiguous)
+                suffixes_.emplace(suffix, Entry{mimeName, category});
+        }
+    }
+}
+
+
+
+/** ***************************************************************************/
+Files::MimeClassifier::Category Files::MimeClassifier::classify(const QString &dirPath,
+                                                               const QString &fileName,
+                                                               QMimeDatabase &mimeDatabase,
+                                                               QString &mimeName) const {
+    const Entry *entry = lookup(fileName);
+    if (entry) {
+        mimeName = entry->mimeName;
+        return entry->category;
+    }
+
+    // Ambiguous or unknown, let the database look at the content
+    mimeName = mimeDatabase.mimeTypeForFile(dirPath + '/' + fileName).name();
+    return category(mimeName);
+}
+
+
+
+/** ***************************************************************************/
+Files::MimeClassifier::Category Files::MimeClassifier::category(const QString &mimeName) {
+    if (mimeName.startsWith("audio"))
+        return Category::Audio;
+    if (mimeName.startsWith("video"))
+        return Category::Video;
+    if (mimeName.startsWith("image"))
+        return Category::Image;
+    if (mimeName.startsWith("application") || mimeName.startsWith("text"))
+        return Category::Document;
+    return Category::Other;
+}
+
+
+
+/** ***************************************************************************/
+const Files::MimeClassifier::Entry *Files::MimeClassifier::lookup(const QString &fileName) const {
+    // The longest suffix wins, try the dots from left to right. A leading
+    // dot marks a hidden file, not a suffix.
+    for (int dot = fileName.indexOf('.', 1); dot != -1; dot = fileName.indexOf('.', dot + 1)) {
+        const QString suffix = fileName.mid(dot + 1);
+        std::unordered_map<QString, Entry, Hash>::const_iterator it = suffixes_.find(suffix);
+        if (it == suffixes_.end())
+            it = suffixes_.find(suffix.toLower());
+        if (it != suffixes_.end())
+            return &it->second;
+    }
+    return nullptr;
+}
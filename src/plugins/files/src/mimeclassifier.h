@@ -0,0 +1,74 @@
+// albert - a simple application launcher for linux
+// Copyright (C) 2014-2016 Manuel Schneider
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include <QHash>
+#include <QString>
+#include <unordered_map>
+class QMimeDatabase;
+
+namespace Files {
+
+/**
+ * @brief The MimeClassifier class
+ * Classifies files by the suffix of their name, using a table built from the
+ * globs of the mime database once. Only files without a known suffix or with
+ * a suffix claimed by mimetypes of different categories are sniffed.
+ * Immutable after construction, shared by the crawlers and their threads.
+ */
+class MimeClassifier final
+{
+public:
+
+    enum class Category { Audio, Video, Image, Document, Other };
+
+    MimeClassifier();
+
+    /** The classifier of the installed mime database, built on first use */
+    static const MimeClassifier &instance();
+
+    /**
+     * Classifies a file
+     * @param dirPath The path of the dir of the file
+     * @param fileName The name of the file. The file is read if it is ambiguous.
+     * @param mimeDatabase The mime database used to sniff
+     * @param mimeName Set to the name of the mimetype of the file
+     * @return The category of the file
+     */
+    Category classify(const QString &dirPath, const QString &fileName,
+                      QMimeDatabase &mimeDatabase, QString &mimeName) const;
+
+    /** Returns the category of a mimetype */
+    static Category category(const QString &mimeName);
+
+private:
+
+    struct Hash {
+        size_t operator()(const QString &s) const { return qHash(s); }
+    };
+
+    struct Entry {
+        QString mimeName;
+        Category category;
+    };
+
+    const Entry *lookup(const QString &fileName) const;
+
+    // The unambiguous suffixes, "tar.gz" style, without the leading dot
+    std::unordered_map<QString, Entry, Hash> suffixes_;
+
+};
+}